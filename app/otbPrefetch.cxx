@@ -13,6 +13,35 @@
 
 #include "otbPrefetchCacheAsyncFilter.h"
 
+// Native pixel type of the input file
+#include "otbImageIOFactory.h"
+#include "otbExtendedFilenameToReaderOptions.h"
+#include "otbImageFileReader.h"
+
+// Streaming plan of the output writer
+#include "otbExtendedFilenameToWriterOptions.h"
+#include "otbNumberOfDivisionsStrippedStreamingManager.h"
+#include "otbNumberOfDivisionsTiledStreamingManager.h"
+#include "otbNumberOfLinesStrippedStreamingManager.h"
+#include "otbTileDimensionTiledStreamingManager.h"
+#include "otbRAMDrivenStrippedStreamingManager.h"
+#include "otbRAMDrivenTiledStreamingManager.h"
+#include "otbRAMDrivenAdaptativeStreamingManager.h"
+
+// Cast of the in-memory input images
+#include "otbClampImageFilter.h"
+
+// Concatenation of the prefetched input images
+#include "otbImageList.h"
+#include "otbMultiToMonoChannelExtractROI.h"
+#include "otbImageListToVectorImageFilter.h"
+
+#include "itkCommand.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
 namespace otb
 {
 namespace Wrapper
@@ -27,7 +56,16 @@ public:
   using ConstPointer = itk::SmartPointer<const Self>;
   itkNewMacro(Self);
   itkTypeMacro(Prefetch, otb::Application);
-  using FilterType = otb::PrefetchCacheAsyncFilter<FloatVectorImageType>;
+  // Regions, predictors and statistics do not depend on the pixel type
+  using RegionType = FloatVectorImageType::RegionType;
+  using SizeType = FloatVectorImageType::SizeType;
+  using PredictorType = otb::PrefetchRegionPredictor<RegionType>;
+  using PredictorPointer = PredictorType::Pointer;
+  using PredictorList = std::vector<PredictorPointer>;
+  using PlanPredictorType = otb::PlanRegionPredictor<RegionType>;
+  using StatisticsType = otb::PrefetchStatistics<RegionType>;
+  using CounterType = StatisticsType::Counter;
+  using CommandType = itk::SimpleMemberCommand<Self>;
 
 private:
   void DoInit() override
@@ -40,42 +78,568 @@ private:
     );
 
     SetDocLimitations(
-      "The next output streaming region is guessed from the previous one. "
+      "Unless the streaming plan of the output writer is known, the next output streaming "
+      "regions are guessed from the previous ones. "
       "It is mostly optimized for tiled and stripped splits. Hence when downstream "
-      "filters do otherwise, it can fail to optimize upstream calls."
+      "filters do otherwise, it can fail to optimize upstream calls. "
+      "The memory budget bounds the cached blocks, but the blocks of the current "
+      "requested region are always kept. "
+      "The input is prefetched with its native pixel type (8, 16 and 32 bits integers, "
+      "float or double), other pixel types are prefetched as float. "
+      "The images of an input list must have the same size."
     );
 
     SetDocAuthors("Remi Cresson");
     AddParameter(ParameterType_InputImage, "in", "Input image");
+    MandatoryOff("in");
+    AddParameter(ParameterType_InputImageList, "il", "Input images");
+    SetParameterDescription("il", "Images prefetched together, instead of a single input image: "
+      "the next regions are guessed once, the images are fetched concurrently and share the memory budget. "
+      "The output is the concatenation of their bands.");
+    MandatoryOff("il");
     AddParameter(ParameterType_OutputImage, "out", "Output image");
+
+    AddParameter(ParameterType_Int, "depth", "Maximum number of regions prefetched ahead");
+    SetParameterDescription("depth", "The number of prefetched regions is adapted at runtime "
+      "from the upstream and downstream pipelines timings, up to this value.");
+    SetDefaultParameterInt("depth", 4);
+    SetMinimumParameterIntValue("depth", 1);
+    MandatoryOff("depth");
+
+    AddParameter(ParameterType_Int, "budget", "Memory budget for the cache (MB)");
+    SetDefaultParameterInt("budget", 256);
+    SetMinimumParameterIntValue("budget", 1);
+    MandatoryOff("budget");
+
+    AddParameter(ParameterType_Int, "blocksize", "Size of the cache blocks");
+    SetParameterDescription("blocksize", "Size (in pixels) of the square blocks of the cache. "
+      "When 0, the native blocks of the input image are used if they are known, else 256x256 blocks.");
+    SetDefaultParameterInt("blocksize", 0);
+    SetMinimumParameterIntValue("blocksize", 0);
+    MandatoryOff("blocksize");
+
+    AddParameter(ParameterType_Choice, "predictor", "Predictor of the next requested regions");
+    SetParameterDescription("predictor", "The hit rates of all predictors are reported, "
+      "only the selected one drives the prefetching.");
+    AddChoice("predictor.grid", "Grid");
+    SetParameterDescription("predictor.grid", "Infers the grid of tiles and the walk order from the requested regions.");
+    AddChoice("predictor.stride", "Stride");
+    SetParameterDescription("predictor.stride", "Repeats the periodic pattern of the requested regions.");
+    AddChoice("predictor.legacy", "Legacy");
+    SetParameterDescription("predictor.legacy", "Repeats the offset between the two last requested regions.");
+    SetParameterString("predictor", "grid");
+
+    AddParameter(ParameterType_Choice, "plan", "Streaming plan");
+    SetParameterDescription("plan", "When known, the regions that the writer of the output will request "
+      "are prefetched exactly, instead of being guessed. The predictor takes over when the requested "
+      "regions do not follow the plan.");
+    AddChoice("plan.auto", "Output writer");
+    SetParameterDescription("plan.auto", "The plan is computed like the writer of out does, from the "
+      "streaming options of its extended filename (streaming:type, streaming:sizemode, "
+      "streaming:sizevalue), or from the available RAM by default. There is no plan when the output "
+      "is used in-memory, or when only a box of it is written.");
+    AddChoice("plan.none", "None");
+    SetParameterDescription("plan.none", "The next requested regions are always guessed.");
+    SetParameterString("plan", "auto");
+
+    AddParameter(ParameterType_Directory, "cachedir", "Disk cache directory");
+    SetParameterDescription("cachedir", "Directory where the fetched blocks of the input files are kept "
+      "across runs. Blocks found there are read instead of being requested to the upstream pipeline. "
+      "In-memory inputs are not cached on disk.");
+    MandatoryOff("cachedir");
+
+    AddParameter(ParameterType_Int, "cachesize", "Size of the disk cache (MB)");
+    SetParameterDescription("cachesize", "The least recently used blocks are deleted beyond this size.");
+    SetDefaultParameterInt("cachesize", 4096);
+    SetMinimumParameterIntValue("cachesize", 1);
+    MandatoryOff("cachesize");
+
+    AddParameter(ParameterType_OutputFilename, "trace", "Trace file");
+    SetParameterDescription("trace", "JSON file (Chrome trace format) with the timings of each requested "
+      "region and each fetch job, and the counters. It is written once the pipeline is destroyed.");
+    MandatoryOff("trace");
+
+    // Statistics, updated after each requested region
+    AddParameter(ParameterType_Group, "stats", "Statistics");
+    AddStatisticsParameter("stats.requests", "Number of requested regions");
+    AddStatisticsParameter("stats.processed", "Number of requested pixels");
+    AddStatisticsParameter("stats.hit", "Requested pixels that were prefetched");
+    AddStatisticsParameter("stats.missed", "Requested pixels that were not prefetched");
+    AddStatisticsParameter("stats.extra", "Prefetched pixels that were never requested");
+    AddStatisticsParameter("stats.planhit", "Requested pixels that were in the streaming plan");
+    AddStatisticsParameter("stats.fetched", "Pixels requested to the upstream pipeline");
+    AddStatisticsParameter("stats.fetchedbytes", "Bytes requested to the upstream pipeline");
+    AddStatisticsParameter("stats.disk", "Pixels read from the disk cache");
+    AddStatisticsParameter("stats.fetchtime", "Time spent by the upstream pipeline (s)");
+    AddStatisticsParameter("stats.waittime", "Time spent waiting for the upstream pipeline (s)");
+    AddStatisticsParameter("stats.copytime", "Time spent filling the output (s)");
+    AddStatisticsParameter("stats.stagetime", "Time spent by the workers copying the fetched pixels to the cache (s)");
+  }
+
+  void AddStatisticsParameter(const std::string & key, const std::string & name)
+  {
+    // Counters are 64-bit: doubles hold them exactly up to 2^53
+    AddParameter(ParameterType_Double, key, name);
+    SetParameterRole(key, Role_Output);
+    SetDefaultParameterFloat(key, 0.0);
+    MandatoryOff(key);
   }
   
   
   void DoUpdateParameters() override {} // nothing to do here (parameters are independant).
 
+  PredictorPointer CreatePredictor(const std::string & name)
+  {
+    if (name == "legacy")
+      return otb::LegacyRegionPredictor<RegionType>::New().GetPointer();
+    if (name == "stride")
+      return otb::StrideRegionPredictor<RegionType>::New().GetPointer();
+    return otb::GridRegionPredictor<RegionType>::New().GetPointer();
+  }
+
+  /**
+   * Streaming plan of the writer of out: the regions it will request, in
+   * order. The streaming manager is the one the writer sets up from the
+   * extended filename of out, else its default RAM driven one. The plan is
+   * empty when it cannot be known.
+   */
+  template <class TImage>
+  std::vector<RegionType> GetStreamingPlan(TImage * output)
+  {
+    std::vector<RegionType> plan;
+    if (GetParameterString("plan") == "none" || !HasValue("out"))
+      return plan;
+
+    auto options = otb::ExtendedFilenameToWriterOptions::New();
+    options->SetExtendedFileName(GetParameterString("out"));
+    if (options->BoxIsSet())
+    {
+      otbAppLogINFO(<< "Only a box of the output is written, the next requested regions are guessed");
+      return plan;
+    }
+
+    switch (GetParameterOutputImagePixelType("out"))
+    {
+      case ImagePixelType_uint8:  return GetWriterStreamingPlan<TImage, uint8_t>(output, options);
+      case ImagePixelType_int16:  return GetWriterStreamingPlan<TImage, int16_t>(output, options);
+      case ImagePixelType_uint16: return GetWriterStreamingPlan<TImage, uint16_t>(output, options);
+      case ImagePixelType_int32:  return GetWriterStreamingPlan<TImage, int32_t>(output, options);
+      case ImagePixelType_uint32: return GetWriterStreamingPlan<TImage, uint32_t>(output, options);
+      case ImagePixelType_double: return GetWriterStreamingPlan<TImage, double>(output, options);
+      default:                    return GetWriterStreamingPlan<TImage, float>(output, options);
+    }
+  }
+
+  /**
+   * Streaming plan computed on the image that the writer of out receives:
+   * the output cast to a vector image of the pixel type of out. The RAM
+   * driven streaming managers estimate the memory print of this pipeline.
+   */
+  template <class TImage, class TValue>
+  std::vector<RegionType> GetWriterStreamingPlan(TImage * output, otb::ExtendedFilenameToWriterOptions * options)
+  {
+    using WriterImageType = otb::VectorImage<TValue>;
+    using CastFilterType = otb::ClampImageFilter<TImage, WriterImageType>;
+    typename CastFilterType::Pointer cast = CastFilterType::New();
+    cast->SetInput(output);
+    WriterImageType * writerInput = cast->GetOutput();
+
+    std::vector<RegionType> plan;
+    const std::string type = options->StreamingTypeIsSet() ? options->GetStreamingType() : "auto";
+    const std::string sizeMode = options->StreamingSizeModeIsSet() ? options->GetStreamingSizeMode() : "auto";
+    const double sizeValue = options->StreamingSizeValueIsSet() ? options->GetStreamingSizeValue() : 0.0;
+
+    typename otb::StreamingManager<WriterImageType>::Pointer manager;
+    if (type == "none")
+    {
+      auto divisions = otb::NumberOfDivisionsStrippedStreamingManager<WriterImageType>::New();
+      divisions->SetNumberOfDivisions(1);
+      manager = divisions.GetPointer();
+    }
+    else if (type == "tiled" && sizeMode == "nbsplits")
+    {
+      auto divisions = otb::NumberOfDivisionsTiledStreamingManager<WriterImageType>::New();
+      divisions->SetNumberOfDivisions(static_cast<unsigned int>(sizeValue));
+      manager = divisions.GetPointer();
+    }
+    else if (type == "tiled" && sizeMode == "height")
+    {
+      auto tiles = otb::TileDimensionTiledStreamingManager<WriterImageType>::New();
+      tiles->SetTileDimension(static_cast<unsigned int>(sizeValue));
+      manager = tiles.GetPointer();
+    }
+    else if (type == "tiled")
+    {
+      auto ram = otb::RAMDrivenTiledStreamingManager<WriterImageType>::New();
+      ram->SetAvailableRAMInMB(static_cast<unsigned int>(sizeValue));
+      manager = ram.GetPointer();
+    }
+    else if (type == "stripped" && sizeMode == "nbsplits")
+    {
+      auto divisions = otb::NumberOfDivisionsStrippedStreamingManager<WriterImageType>::New();
+      divisions->SetNumberOfDivisions(static_cast<unsigned int>(sizeValue));
+      manager = divisions.GetPointer();
+    }
+    else if (type == "stripped" && sizeMode == "height")
+    {
+      auto lines = otb::NumberOfLinesStrippedStreamingManager<WriterImageType>::New();
+      lines->SetNumberOfLinesPerStrip(static_cast<unsigned int>(sizeValue));
+      manager = lines.GetPointer();
+    }
+    else if (type == "stripped")
+    {
+      auto ram = otb::RAMDrivenStrippedStreamingManager<WriterImageType>::New();
+      ram->SetAvailableRAMInMB(static_cast<unsigned int>(sizeValue));
+      manager = ram.GetPointer();
+    }
+    else
+    {
+      auto ram = otb::RAMDrivenAdaptativeStreamingManager<WriterImageType>::New();
+      ram->SetAvailableRAMInMB(static_cast<unsigned int>(sizeValue));
+      manager = ram.GetPointer();
+    }
+
+    writerInput->UpdateOutputInformation();
+    manager->PrepareStreaming(writerInput, writerInput->GetLargestPossibleRegion());
+    for (unsigned int i = 0; i < manager->GetNumberOfSplits(); ++i)
+      plan.push_back(manager->GetSplit(i));
+    otbAppLogINFO(<< "Streaming plan of " << plan.size() << " regions (" << type << " streaming of the output)");
+    return plan;
+  }
+
+  /** Prefetch the streaming plan of the output, when it is known */
+  template <class TFilter, class TImage>
+  void SetUpStreamingPlan(TFilter * filter, TImage * output)
+  {
+    filter->SetStreamingPlan(GetStreamingPlan(output));
+    m_ActivePredictor = filter->GetPredictor();
+  }
+
+  void UpdateStatisticsParameters()
+  {
+    const StatisticsType * stats = m_Statistics;
+    SetParameterDouble("stats.requests", stats->Get(CounterType::Requests));
+    SetParameterDouble("stats.processed", stats->Get(CounterType::ProcessedPixels));
+    SetParameterDouble("stats.hit", stats->Get(CounterType::HitPixels));
+    SetParameterDouble("stats.missed", stats->Get(CounterType::MissedPixels));
+    SetParameterDouble("stats.extra", stats->Get(CounterType::ExtraPixels));
+    auto planPredictor = dynamic_cast<PlanPredictorType *>(m_ActivePredictor.GetPointer());
+    SetParameterDouble("stats.planhit", planPredictor ? planPredictor->GetPlanHitPixels() : 0);
+    SetParameterDouble("stats.fetched", stats->Get(CounterType::FetchedPixels));
+    SetParameterDouble("stats.fetchedbytes", stats->Get(CounterType::FetchedBytes));
+    SetParameterDouble("stats.disk", stats->Get(CounterType::DiskPixels));
+    SetParameterDouble("stats.fetchtime", stats->GetSeconds(CounterType::FetchNanoseconds));
+    SetParameterDouble("stats.waittime", stats->GetSeconds(CounterType::WaitNanoseconds));
+    SetParameterDouble("stats.copytime", stats->GetSeconds(CounterType::CopyNanoseconds));
+    SetParameterDouble("stats.stagetime", stats->GetSeconds(CounterType::StageNanoseconds));
+  }
+
+  /**
+   * Native pixel type and number of bands of an input (in, or an image of il).
+   * The pixel type of an input file is read from its header, since the image
+   * of the parameter would be read as a float vector image.
+   */
+  ImagePixelType GetInputPixelType(const std::string & key, unsigned int idx, unsigned int & nbOfBands)
+  {
+    const std::string filename = (key == "il") ? GetParameterStringList(key)[idx] : GetParameterString(key);
+    if (filename.empty())
+    {
+      // In-memory input
+      nbOfBands = GetImageNbBands(key, idx);
+      return GetImageBasePixelType(key, idx);
+    }
+
+    auto options = otb::ExtendedFilenameToReaderOptions::New();
+    options->SetExtendedFileName(filename);
+    auto imageIO = otb::ImageIOFactory::CreateImageIO(options->GetSimpleFileName(), otb::ImageIOFactory::ReadMode);
+    if (imageIO.IsNull())
+    {
+      otbAppLogWARNING(<< "Unable to read the pixel type of " << filename << ", the input is prefetched as float");
+      nbOfBands = GetImageNbBands(key, idx);
+      return ImagePixelType_float;
+    }
+    imageIO->SetFileName(options->GetSimpleFileName());
+    imageIO->ReadImageInformation();
+    nbOfBands = imageIO->GetNumberOfComponents();
+    switch (imageIO->GetComponentType())
+    {
+      case otb::ImageIOBase::UCHAR:  return ImagePixelType_uint8;
+      case otb::ImageIOBase::CHAR:   return ImagePixelType_int16;
+      case otb::ImageIOBase::USHORT: return ImagePixelType_uint16;
+      case otb::ImageIOBase::SHORT:  return ImagePixelType_int16;
+      case otb::ImageIOBase::UINT:   return ImagePixelType_uint32;
+      case otb::ImageIOBase::INT:    return ImagePixelType_int32;
+      case otb::ImageIOBase::DOUBLE: return ImagePixelType_double;
+      default:                       return ImagePixelType_float;
+    }
+  }
+
+  /** Prefetch settings, shared by all the image types */
+  template <class TFilter>
+  void SetUpFilter(TFilter * filter)
+  {
+    filter->SetMaxDepth(GetParameterInt("depth"));
+    filter->SetMemoryBudget(static_cast<uint64_t>(GetParameterInt("budget")) * 1024 * 1024);
+    SizeType blockSize;
+    blockSize.Fill(GetParameterInt("blocksize"));
+    filter->SetBlockSize(blockSize);
+    filter->SetPredictor(m_Predictor);
+    for (auto & predictor : m_MonitoredPredictors)
+      filter->AddMonitoredPredictor(predictor);
+
+    if (HasValue("trace"))
+      filter->SetTraceFileName(GetParameterString("trace"));
+
+    if (HasValue("cachedir"))
+    {
+      filter->SetDiskCacheDirectory(GetParameterString("cachedir"));
+      filter->SetDiskCacheMaxBytes(static_cast<uint64_t>(GetParameterInt("cachesize")) * 1024 * 1024);
+    }
+
+    m_Filter = filter;
+    m_Statistics = filter->GetStatistics();
+  }
+
+  /**
+   * Set up the filter for the input image type. Only the output parameter
+   * casts the pixels, when the downstream consumer needs another type.
+   */
+  template <class TImage>
+  void PrefetchImage()
+  {
+    using FilterType = otb::PrefetchCacheAsyncFilter<TImage>;
+    typename FilterType::Pointer filter = FilterType::New();
+    filter->SetInput(GetParameterImage<TImage>("in"));
+    filter->SetInputIdentifier(0, GetParameterString("in"));
+    SetUpFilter(filter.GetPointer());
+    SetParameterOutputImage<TImage>("out", filter->GetOutput());
+    SetUpStreamingPlan(filter.GetPointer(), filter->GetOutput());
+  }
+
+  /** Scalar image for single band inputs, else vector image */
+  template <class TValue>
+  void PrefetchImage(unsigned int nbOfBands)
+  {
+    if (nbOfBands == 1)
+      PrefetchImage<otb::Image<TValue>>();
+    else
+      PrefetchImage<otb::VectorImage<TValue>>();
+  }
+
+  /** Cast an image to another image type */
+  template <class TInputImage, class TOutputImage>
+  TOutputImage * CastImage(TInputImage * image)
+  {
+    using CastFilterType = otb::ClampImageFilter<TInputImage, TOutputImage>;
+    typename CastFilterType::Pointer cast = CastFilterType::New();
+    cast->SetInput(image);
+    m_Filters.push_back(cast.GetPointer());
+    return cast->GetOutput();
+  }
+
+  /**
+   * Image of il, read with the given type. Files are read with their own
+   * reader. In-memory images are used as is when they have this type, scalar
+   * images with the same pixel type are cast directly, and the other ones
+   * are cast from their float vector image.
+   */
+  template <class TImage>
+  TImage * GetInputListImage(unsigned int idx)
+  {
+    const std::string filename = GetParameterStringList("il")[idx];
+    if (!filename.empty())
+    {
+      using ReaderType = otb::ImageFileReader<TImage>;
+      typename ReaderType::Pointer reader = ReaderType::New();
+      reader->SetFileName(filename);
+      m_Filters.push_back(reader.GetPointer());
+      return reader->GetOutput();
+    }
+
+    using ScalarImageType = otb::Image<typename TImage::InternalPixelType>;
+    ImageBaseType * imageBase = GetParameterImageBase("il", idx);
+    if (TImage * image = dynamic_cast<TImage *>(imageBase))
+      return image;
+    if (ScalarImageType * scalarImage = dynamic_cast<ScalarImageType *>(imageBase))
+      return CastImage<ScalarImageType, TImage>(scalarImage);
+    FloatVectorImageType * floatImage = GetParameterImageList("il")->GetNthElement(idx).GetPointer();
+    if (TImage * image = dynamic_cast<TImage *>(floatImage))
+      return image;
+    return CastImage<FloatVectorImageType, TImage>(floatImage);
+  }
+
+  /**
+   * Set up the filter for the images of il, that are all prefetched as
+   * vector images of the same pixel type. The bands of the outputs of the
+   * filter are concatenated, like the ConcatenateImages application does.
+   */
+  template <class TValue>
+  void PrefetchImageList(unsigned int nbOfImages)
+  {
+    using ImageType = otb::VectorImage<TValue>;
+    using BandType = otb::Image<TValue>;
+    using BandListType = otb::ImageList<BandType>;
+    using ExtractorType = otb::MultiToMonoChannelExtractROI<TValue, TValue>;
+    using ConcatenerType = otb::ImageListToVectorImageFilter<BandListType, ImageType>;
+    using FilterType = otb::PrefetchCacheAsyncFilter<ImageType>;
+    typename FilterType::Pointer filter = FilterType::New();
+    for (unsigned int idx = 0; idx < nbOfImages; ++idx)
+    {
+      ImageType * image = GetInputListImage<ImageType>(idx);
+      image->UpdateOutputInformation();
+      filter->SetInput(idx, image);
+      filter->SetInputIdentifier(idx, GetParameterStringList("il")[idx]);
+    }
+    SetUpFilter(filter.GetPointer());
+
+    typename BandListType::Pointer bands = BandListType::New();
+    for (unsigned int idx = 0; idx < nbOfImages; ++idx)
+    {
+      filter->GetOutput(idx)->UpdateOutputInformation();
+      for (unsigned int band = 0; band < filter->GetOutput(idx)->GetNumberOfComponentsPerPixel(); ++band)
+      {
+        typename ExtractorType::Pointer extractor = ExtractorType::New();
+        extractor->SetInput(filter->GetOutput(idx));
+        extractor->SetChannel(band + 1);
+        extractor->UpdateOutputInformation();
+        m_Filters.push_back(extractor.GetPointer());
+        bands->PushBack(extractor->GetOutput());
+      }
+    }
+    typename ConcatenerType::Pointer concatener = ConcatenerType::New();
+    concatener->SetInput(bands);
+    m_Filters.push_back(bands.GetPointer());
+    m_Filters.push_back(concatener.GetPointer());
+    SetParameterOutputImage<ImageType>("out", concatener->GetOutput());
+    SetUpStreamingPlan(filter.GetPointer(), concatener->GetOutput());
+  }
+
+  /** Name of the prefetched pixel type */
+  static std::string GetPixelTypeName(ImagePixelType pixelType)
+  {
+    switch (pixelType)
+    {
+      case ImagePixelType_uint8:  return "uint8";
+      case ImagePixelType_int16:  return "int16";
+      case ImagePixelType_uint16: return "uint16";
+      case ImagePixelType_int32:  return "int32";
+      case ImagePixelType_uint32: return "uint32";
+      case ImagePixelType_double: return "double";
+      default:                    return "float";
+    }
+  }
+
   void DoExecute() override
   {
-    auto filter = FilterType::New();
-    filter->SetInput(GetParameterImage("in"));
-    SetParameterOutputImage("out", filter->GetOutput());
+    // The selected predictor drives the prefetching, the others are only monitored
+    const std::string predictor = GetParameterString("predictor");
+    m_MonitoredPredictors.clear();
+    for (const std::string name : {"grid", "stride", "legacy"})
+    {
+      if (name == predictor)
+        m_Predictor = CreatePredictor(name);
+      else
+        m_MonitoredPredictors.push_back(CreatePredictor(name));
+    }
+
+    if (HasValue("in") == HasValue("il"))
+      otbAppLogFATAL(<< "Either an input image (in) or a list of input images (il) must be set");
+    // The workers of a previous filter may still fetch from its upstream filters
+    m_Filter = nullptr;
+    m_Filters.clear();
+
+    if (HasValue("il"))
+    {
+      // Common pixel type of the images, else float
+      const unsigned int nbOfImages = GetParameterStringList("il").size();
+      unsigned int nbOfBands = 0;
+      ImagePixelType pixelType = GetInputPixelType("il", 0, nbOfBands);
+      for (unsigned int idx = 1; idx < nbOfImages; ++idx)
+      {
+        unsigned int nbOfImageBands = 0;
+        if (GetInputPixelType("il", idx, nbOfImageBands) != pixelType)
+          pixelType = ImagePixelType_float;
+        nbOfBands += nbOfImageBands;
+      }
+      switch (pixelType)
+      {
+        case ImagePixelType_uint8:  PrefetchImageList<uint8_t>(nbOfImages);  break;
+        case ImagePixelType_int16:  PrefetchImageList<int16_t>(nbOfImages);  break;
+        case ImagePixelType_uint16: PrefetchImageList<uint16_t>(nbOfImages); break;
+        case ImagePixelType_int32:  PrefetchImageList<int32_t>(nbOfImages);  break;
+        case ImagePixelType_uint32: PrefetchImageList<uint32_t>(nbOfImages); break;
+        case ImagePixelType_double: PrefetchImageList<double>(nbOfImages);   break;
+        default:                    PrefetchImageList<float>(nbOfImages);    break;
+      }
+      otbAppLogINFO(<< "Prefetching " << nbOfImages << " images (" << nbOfBands << " bands) of " 
+        << GetPixelTypeName(pixelType) << " pixels");
+    }
+    else
+    {
+      unsigned int nbOfBands = 0;
+      const ImagePixelType pixelType = GetInputPixelType("in", 0, nbOfBands);
+      switch (pixelType)
+      {
+        case ImagePixelType_uint8:  PrefetchImage<uint8_t>(nbOfBands);  break;
+        case ImagePixelType_int16:  PrefetchImage<int16_t>(nbOfBands);  break;
+        case ImagePixelType_uint16: PrefetchImage<uint16_t>(nbOfBands); break;
+        case ImagePixelType_int32:  PrefetchImage<int32_t>(nbOfBands);  break;
+        case ImagePixelType_uint32: PrefetchImage<uint32_t>(nbOfBands); break;
+        case ImagePixelType_double: PrefetchImage<double>(nbOfBands);   break;
+        default:                    PrefetchImage<float>(nbOfBands);    break;
+      }
+      otbAppLogINFO(<< "Prefetching " << nbOfBands << " band(s) of " << GetPixelTypeName(pixelType) << " pixels");
+    }
+
+    // The statistics parameters are kept up to date, since the application
+    // can also be used in-memory, without AfterExecuteAndWriteOutputs()
+    m_StatisticsCommand = CommandType::New();
+    m_StatisticsCommand->SetCallbackFunction(this, &Self::UpdateStatisticsParameters);
+    m_Filter->AddObserver(itk::EndEvent(), m_StatisticsCommand);
+
     RegisterPipeline();
   }
   
-  /**
-  TODO when https://gitlab.orfeo-toolbox.org/orfeotoolbox/otb/-/issues/2374 is fixed
   void AfterExecuteAndWriteOutputs() override
   {
+    UpdateStatisticsParameters();
 
-    float nbOfProcessedPixels = filter->GetNbOfProcessedPixels();
-    float percentMissed = 100 * filter->GetMissedGuesses() / nbOfProcessedPixels;
-    float percentGood = 100 * filter->GetGoodGuesses() / nbOfProcessedPixels;
-    float percentExtra = 100 * filter->GetExtraGuesses() / nbOfProcessedPixels;
-    otbAppLogINFO(<< filter->GetMissedGuesses() << " missing guessed pixels (" << percentMissed << " %)");
-    otbAppLogINFO(<< filter->GetGoodGuesses() << " good guessed pixels (" << percentGood << " %)");
-    otbAppLogINFO(<< filter->GetExtraGuesses() << " extra guessed pixels (" << percentExtra << " %)");
+    const StatisticsType * stats = m_Statistics;
+    const double nbOfProcessedPixels = std::max(stats->Get(CounterType::ProcessedPixels), uint64_t(1));
+    otbAppLogINFO(<< stats->Get(CounterType::MissedPixels) << " missing guessed pixels (" 
+      << 100 * stats->Get(CounterType::MissedPixels) / nbOfProcessedPixels << " %)");
+    otbAppLogINFO(<< stats->Get(CounterType::HitPixels) << " good guessed pixels (" 
+      << 100 * stats->Get(CounterType::HitPixels) / nbOfProcessedPixels << " %)");
+    otbAppLogINFO(<< stats->Get(CounterType::ExtraPixels) << " extra guessed pixels (" 
+      << 100 * stats->Get(CounterType::ExtraPixels) / nbOfProcessedPixels << " %)");
+    otbAppLogINFO(<< stats->Get(CounterType::FetchedPixels) << " pixels requested to the upstream pipeline (" 
+      << stats->Get(CounterType::FetchedPixels) / nbOfProcessedPixels << " per processed pixel)");
+    if (HasValue("cachedir"))
+      otbAppLogINFO(<< stats->Get(CounterType::DiskPixels) << " pixels read from the disk cache");
+    otbAppLogINFO(<< "Total wait: " << stats->GetSeconds(CounterType::WaitNanoseconds) << "s");
 
+    // Predictors hit rates. With a streaming plan, the selected predictor is its fallback.
+    PredictorList predictors(m_MonitoredPredictors);
+    predictors.insert(predictors.begin(), m_Predictor);
+    if (m_ActivePredictor != m_Predictor)
+      predictors.insert(predictors.begin(), m_ActivePredictor);
+    for (auto & predictor : predictors)
+    {
+      const char * role = (predictor == m_ActivePredictor) ? " (active)" : (predictor == m_Predictor ? " (fallback)" : "");
+      otbAppLogINFO(<< "Predictor " << predictor->GetPredictorName() << role
+        << ": hit rate " << 100 * predictor->GetHitRate() << " %, precision " << 100 * predictor->GetPrecision() << " %");
+    }
   }
-  */
+
+  // The filter is declared last, so that it is destroyed (and its workers
+  // stopped) before the upstream filters it fetches from
+  std::vector<itk::LightObject::Pointer> m_Filters; // readers and concatenation of il
+  itk::ProcessObject::Pointer m_Filter;
+  StatisticsType::Pointer m_Statistics;
+  PredictorPointer m_Predictor;
+  PredictorPointer m_ActivePredictor;
+  PredictorList m_MonitoredPredictors;
+  CommandType::Pointer m_StatisticsCommand;
 };
 
 }
@@ -0,0 +1,405 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+/**
+ * Offline benchmark of the PrefetchCacheAsyncFilter.
+ *
+ * A SyntheticLatencySource stands for the remote input, and a synthetic
+ * downstream consumer requests the regions of a streaming plan one after the
+ * other, spending a configurable compute time on each. Every configuration of
+ * the sweep (split order, tile size, number of bands, padding, pixel type) is
+ * run without prefetch (baseline), then with prefetch for each predictor
+ * ("legacy", "stride", "grid", and "plan" for the exact streaming plan), and
+ * the results are written as JSON.
+ *
+ * Usage: otbPrefetchBenchmark [key=value ...]
+ *   size=1024        image size (pixels)
+ *   latency=30       latency of each upstream request (ms)
+ *   bandwidth=100    upstream bandwidth (MB/s)
+ *   jitter=10        maximum jitter of each upstream request (ms)
+ *   compute=200      downstream compute time (ms per megapixel)
+ *   seed=0           seed of the jitter generator
+ *   depth=4          maximum prefetch depth
+ *   budget=256       memory budget of the prefetch cache (MB)
+ *   quick=0          when 1, only run a reduced sweep
+ *   output=-         JSON output file (- for the standard output)
+ *
+ * The exit code is non-zero when a pixel of the prefetched output differs
+ * from the baseline output.
+ */
+
+#include "otbVectorImage.h"
+#include "otbPrefetchCacheAsyncFilter.h"
+#include "otbSyntheticLatencySource.h"
+
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+typedef itk::ImageRegion<2>                           RegionType;
+typedef RegionType::IndexType                         IndexType;
+typedef RegionType::SizeType                          SizeType;
+typedef std::vector<RegionType>                       RegionList;
+
+/* Benchmark settings */
+struct Settings {
+  unsigned int size = 1024;
+  double latency = 30;
+  double bandwidth = 100;
+  double jitter = 10;
+  double compute = 200;
+  unsigned int seed = 0;
+  unsigned int depth = 4;
+  unsigned int budget = 256;
+  bool quick = false;
+  std::string output = "-";
+};
+
+/* Configuration of a run */
+struct Config {
+  std::string split;
+  unsigned int tileSize;
+  unsigned int bands;
+  unsigned int padding;
+  std::string pixelType;
+};
+
+/* Measurements of a run */
+struct Result {
+  double seconds = 0;
+  double waitSeconds = 0;
+  uint64_t processedPixels = 0;
+  uint64_t hitPixels = 0;
+  uint64_t extraBytes = 0;
+  uint64_t upstreamRequests = 0;
+  uint64_t upstreamBytes = 0;
+  std::vector<uint64_t> hashes; // hash of the pixels of each request
+};
+
+
+/**
+ * Mix a word in a FNV-1a hash.
+ */
+inline uint64_t Mix(uint64_t hash, uint64_t word)
+{
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    hash ^= (word >> (8 * i)) & 0xff;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+/**
+ * Index of the first request whose pixels differ between two runs, or the
+ * number of requests when they are all the same.
+ */
+size_t FirstDifference(const Result & baseline, const Result & prefetched)
+{
+  size_t i = 0;
+  while (i < baseline.hashes.size() && i < prefetched.hashes.size() && baseline.hashes[i] == prefetched.hashes[i])
+    ++i;
+  return i;
+}
+
+
+/**
+ * Regions requested by the downstream consumer, in order.
+ * "tiled": rows of tiles, "stripped": full width strips, "serpentine": rows
+ * of tiles walked back and forth, "columns": columns of tiles. Each region is
+ * padded by the neighborhood radius, and cropped to the image.
+ */
+RegionList MakeSplits(const RegionType & largestRegion, const Config & config)
+{
+  const long size = largestRegion.GetSize(0);
+  const long tile = config.tileSize;
+  const long nbTiles = (size + tile - 1) / tile;
+  RegionList splits;
+  auto addTile = [&](long tx, long ty, long width) {
+    RegionType region;
+    region.SetIndex(0, tx * tile);
+    region.SetIndex(1, ty * tile);
+    region.SetSize(0, width);
+    region.SetSize(1, tile);
+    region.PadByRadius(config.padding);
+    region.Crop(largestRegion);
+    splits.push_back(region);
+  };
+  for (long i = 0; i < nbTiles; ++i)
+  {
+    if (config.split == "stripped")
+    {
+      addTile(0, i, size);
+      continue;
+    }
+    for (long j = 0; j < nbTiles; ++j)
+    {
+      if (config.split == "columns")
+        addTile(i, j, tile);
+      else if (config.split == "serpentine" && i % 2 == 1)
+        addTile(nbTiles - 1 - j, i, tile);
+      else
+        addTile(j, i, tile);
+    }
+  }
+  return splits;
+}
+
+
+/**
+ * Run the downstream consumer on an image, prefetched with the given
+ * predictor, or without prefetch when the predictor is empty.
+ */
+template <class TImage>
+Result RunImage(const Settings & settings, const Config & config, const std::string & predictor)
+{
+  typedef otb::SyntheticLatencySource<TImage>    SourceType;
+  typedef otb::PrefetchCacheAsyncFilter<TImage>  FilterType;
+  typedef typename FilterType::CounterType       CounterType;
+  typedef typename TImage::InternalPixelType     ValueType;
+
+  const bool prefetch = !predictor.empty();
+  SizeType size;
+  size.Fill(settings.size);
+  auto source = SourceType::New();
+  source->SetSize(size);
+  source->SetNumberOfBands(config.bands);
+  source->SetLatency(1e-3 * settings.latency);
+  source->SetBandwidth(1e6 * settings.bandwidth);
+  source->SetJitter(1e-3 * settings.jitter);
+  source->SetSeed(settings.seed);
+
+  typename FilterType::Pointer filter;
+  TImage * image = source->GetOutput();
+  if (prefetch)
+  {
+    filter = FilterType::New();
+    filter->SetInput(source->GetOutput());
+    filter->SetMaxDepth(settings.depth);
+    filter->SetMemoryBudget(static_cast<uint64_t>(settings.budget) * 1024 * 1024);
+    if (predictor == "legacy")
+      filter->SetPredictor(otb::LegacyRegionPredictor<RegionType>::New().GetPointer());
+    else if (predictor == "stride")
+      filter->SetPredictor(otb::StrideRegionPredictor<RegionType>::New().GetPointer());
+    image = filter->GetOutput();
+  }
+  source->UpdateOutputInformation();
+  image->UpdateOutputInformation();
+  const RegionList splits = MakeSplits(image->GetLargestPossibleRegion(), config);
+
+  // The plan is made of the tiles, padded by the filter
+  if (predictor == "plan")
+  {
+    Config tiles(config);
+    tiles.padding = 0;
+    SizeType radius;
+    radius.Fill(config.padding);
+    filter->SetStreamingPlan(MakeSplits(image->GetLargestPossibleRegion(), tiles), radius);
+  }
+
+  Result result;
+  auto start{std::chrono::steady_clock::now()};
+  for (auto & region : splits)
+  {
+    // Request the region
+    auto requestStart{std::chrono::steady_clock::now()};
+    image->SetRequestedRegion(region);
+    image->PropagateRequestedRegion();
+    image->UpdateOutputData();
+    const std::chrono::duration<double> requestSecs{std::chrono::steady_clock::now() - requestStart};
+    if (!prefetch)
+      result.waitSeconds += requestSecs.count();
+
+    // Consume it. Each pixel value is hashed with its position, so that
+    // swapped or misplaced pixels are caught as well as wrong values
+    uint64_t hash = 14695981039346656037ULL;
+    itk::ImageRegionConstIteratorWithIndex<TImage> it(image, region);
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+      const auto pixel = it.Get();
+      hash = Mix(Mix(hash, it.GetIndex()[0]), it.GetIndex()[1]);
+      for (unsigned int band = 0; band < config.bands; ++band)
+      {
+        const double value = pixel[band];
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        hash = Mix(hash, bits);
+      }
+    }
+    result.hashes.push_back(hash);
+    result.processedPixels += region.GetNumberOfPixels();
+    std::this_thread::sleep_until(requestStart + std::chrono::duration<double>(requestSecs.count() +
+      1e-9 * settings.compute * region.GetNumberOfPixels()));
+  }
+  const std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() - start};
+  result.seconds = elapsed.count();
+
+  if (prefetch)
+  {
+    const typename FilterType::StatisticsType * stats = filter->GetStatistics();
+    result.waitSeconds = stats->GetSeconds(CounterType::WaitNanoseconds);
+    result.hitPixels = stats->Get(CounterType::HitPixels);
+    result.extraBytes = stats->Get(CounterType::ExtraPixels) * config.bands * sizeof(ValueType);
+  }
+  filter = nullptr;
+  result.upstreamRequests = source->GetNumberOfRequests();
+  result.upstreamBytes = source->GetRequestedBytes();
+  return result;
+}
+
+
+/**
+ * Run the downstream consumer on an image of the pixel type of the configuration.
+ */
+Result Run(const Settings & settings, const Config & config, const std::string & predictor)
+{
+  if (config.pixelType == "uint16")
+    return RunImage<otb::VectorImage<uint16_t, 2>>(settings, config, predictor);
+  return RunImage<otb::VectorImage<float, 2>>(settings, config, predictor);
+}
+
+
+/**
+ * JSON object of a run.
+ */
+void WriteResult(std::ostream & os, const Result & result)
+{
+  const double processed = std::max(result.processedPixels, uint64_t(1));
+  os << "{\"seconds\":" << result.seconds
+     << ",\"throughput\":" << result.processedPixels / std::max(result.seconds, 1e-9)
+     << ",\"waitSeconds\":" << result.waitSeconds
+     << ",\"processedPixels\":" << result.processedPixels
+     << ",\"hitRatio\":" << result.hitPixels / processed
+     << ",\"extraBytes\":" << result.extraBytes
+     << ",\"upstreamRequests\":" << result.upstreamRequests
+     << ",\"upstreamBytes\":" << result.upstreamBytes << "}";
+}
+
+
+bool ParseSettings(int argc, char * argv[], Settings & settings)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg(argv[i]);
+    const auto sep = arg.find('=');
+    if (sep == std::string::npos)
+      return false;
+    const std::string key = arg.substr(0, sep);
+    std::istringstream value(arg.substr(sep + 1));
+    if (key == "size") value >> settings.size;
+    else if (key == "latency") value >> settings.latency;
+    else if (key == "bandwidth") value >> settings.bandwidth;
+    else if (key == "jitter") value >> settings.jitter;
+    else if (key == "compute") value >> settings.compute;
+    else if (key == "seed") value >> settings.seed;
+    else if (key == "depth") value >> settings.depth;
+    else if (key == "budget") value >> settings.budget;
+    else if (key == "quick") value >> settings.quick;
+    else if (key == "output") value >> settings.output;
+    else
+      return false;
+    if (value.fail())
+      return false;
+  }
+  return true;
+}
+
+
+int main(int argc, char * argv[])
+{
+  Settings settings;
+  if (!ParseSettings(argc, argv, settings))
+  {
+    std::cerr << "Usage: " << argv[0] << " [size=1024] [latency=30] [bandwidth=100] [jitter=10] [compute=200] "
+              << "[seed=0] [depth=4] [budget=256] [quick=0] [output=-]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Sweep
+  std::vector<std::string> splits = {"tiled", "stripped", "serpentine", "columns"};
+  std::vector<unsigned int> tileSizes = {128, 256};
+  std::vector<unsigned int> bands = {1, 4};
+  std::vector<unsigned int> paddings = {0, 16};
+  std::vector<std::string> pixelTypes = {"float", "uint16"};
+  std::vector<std::string> predictors = {"legacy", "stride", "grid", "plan"};
+  if (settings.quick)
+  {
+    splits = {"tiled", "stripped"};
+    tileSizes = {256};
+    bands = {4};
+    predictors = {"grid", "plan"};
+  }
+
+  std::ofstream file;
+  if (settings.output != "-")
+  {
+    file.open(settings.output);
+    if (!file)
+    {
+      std::cerr << "Unable to write " << settings.output << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::ostream & os = (settings.output != "-") ? file : std::cout;
+
+  bool valid = true;
+  os << "{\"settings\":{\"size\":" << settings.size << ",\"latency\":" << settings.latency
+     << ",\"bandwidth\":" << settings.bandwidth << ",\"jitter\":" << settings.jitter
+     << ",\"compute\":" << settings.compute << ",\"seed\":" << settings.seed
+     << ",\"depth\":" << settings.depth << ",\"budget\":" << settings.budget << "},\n\"runs\":[";
+  bool first = true;
+  for (auto & split : splits)
+    for (auto & tileSize : tileSizes)
+      for (auto & nbOfBands : bands)
+        for (auto & padding : paddings)
+          for (auto & pixelType : pixelTypes)
+          {
+            const Config config{split, tileSize, nbOfBands, padding, pixelType};
+            std::cerr << "Running " << split << " tile " << tileSize << " bands " << nbOfBands << " padding " << padding
+                      << " " << pixelType << std::endl;
+            const Result baseline = Run(settings, config, "");
+            for (auto & predictor : predictors)
+            {
+              const Result prefetched = Run(settings, config, predictor);
+              const size_t difference = FirstDifference(baseline, prefetched);
+              const bool same = (difference == baseline.hashes.size());
+              valid &= same;
+              if (!same)
+                std::cerr << "Predictor " << predictor << ": pixels of request " << difference
+                          << " differ from the baseline" << std::endl;
+
+              os << (first ? "\n" : ",\n") << "{\"split\":\"" << split << "\",\"tileSize\":" << tileSize
+                 << ",\"bands\":" << nbOfBands << ",\"padding\":" << padding << ",\"pixelType\":\"" << pixelType
+                 << "\",\"predictor\":\"" << predictor << "\",\"baseline\":";
+              WriteResult(os, baseline);
+              os << ",\"prefetch\":";
+              WriteResult(os, prefetched);
+              os << ",\"speedup\":" << baseline.seconds / std::max(prefetched.seconds, 1e-9)
+                 << ",\"valid\":" << (same ? "true" : "false") << "}";
+              first = false;
+            }
+          }
+  os << "\n],\n\"valid\":" << (valid ? "true" : "false") << "}\n";
+
+  if (!valid)
+    std::cerr << "Prefetched outputs differ from the baseline" << std::endl;
+  return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,128 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbSyntheticLatencySource_h
+#define otbSyntheticLatencySource_h
+
+#include "itkImageSource.h"
+
+// OTB log
+#include "otbMacro.h"
+#include "itkMacro.h"
+
+#include <random>
+#include <cstdint>
+
+namespace otb
+{
+
+/**
+ * \class SyntheticLatencySource
+ * \brief Image source that mimics a remote image read through GDAL/HTTP.
+ *
+ * Each requested region is generated in a single call, which is slowed down by
+ * a latency model: a fixed latency per request, plus the transfer time of the
+ * requested bytes at the given bandwidth, plus a random jitter (uniform in
+ * [-Jitter, +Jitter], drawn from a seeded generator so that runs are
+ * reproducible).
+ *
+ * The value of a pixel only depends on its index and band, see PixelValue().
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TOutputImage>
+class ITK_EXPORT SyntheticLatencySource : public itk::ImageSource<TOutputImage>
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef SyntheticLatencySource         Self;
+  typedef itk::ImageSource<TOutputImage> Superclass;
+  typedef itk::SmartPointer<Self>        Pointer;
+  typedef itk::SmartPointer<const Self>  ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(SyntheticLatencySource, ImageSource);
+
+  /** Images typedefs */
+  typedef TOutputImage                   ImageType;
+  typedef typename ImageType::IndexType  IndexType;
+  typedef typename ImageType::SizeType   SizeType;
+  typedef typename ImageType::RegionType RegionType;
+  typedef typename ImageType::InternalPixelType ValueType;
+
+  /** Size of the image */
+  itkSetMacro(Size, SizeType);
+  itkGetConstReferenceMacro(Size, SizeType);
+
+  /** Number of bands */
+  itkSetMacro(NumberOfBands, unsigned int);
+  itkGetMacro(NumberOfBands, unsigned int);
+
+  /** Latency of each request (seconds) */
+  itkSetMacro(Latency, double);
+  itkGetMacro(Latency, double);
+
+  /** Bandwidth (bytes per second, no transfer time when 0) */
+  itkSetMacro(Bandwidth, double);
+  itkGetMacro(Bandwidth, double);
+
+  /** Maximum jitter of each request (seconds) */
+  itkSetMacro(Jitter, double);
+  itkGetMacro(Jitter, double);
+
+  /** Seed of the jitter generator */
+  void SetSeed(unsigned int seed)
+  {
+    m_Generator.seed(seed);
+  }
+
+  /** Number of generated regions, and their size in bytes */
+  itkGetMacro(NumberOfRequests, uint64_t);
+  itkGetMacro(RequestedBytes, uint64_t);
+
+  /** Value of a pixel band */
+  static ValueType PixelValue(const IndexType & index, unsigned int band)
+  {
+    return static_cast<ValueType>((index[0] * 31 + index[1] * 17 + band * 7) % 251);
+  }
+
+protected:
+  SyntheticLatencySource();
+  ~SyntheticLatencySource() {}
+
+  void GenerateOutputInformation() override;
+
+  void GenerateData() override;
+
+private:
+  SyntheticLatencySource(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+  SizeType m_Size;
+  unsigned int m_NumberOfBands;
+  double m_Latency;
+  double m_Bandwidth;
+  double m_Jitter;
+  std::mt19937 m_Generator;
+  uint64_t m_NumberOfRequests;
+  uint64_t m_RequestedBytes;
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbSyntheticLatencySource.hxx"
+
+#endif
@@ -0,0 +1,97 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbSyntheticLatencySource_txx
+#define otbSyntheticLatencySource_txx
+
+#include "otbSyntheticLatencySource.h"
+
+#include "itkImageRegionIteratorWithIndex.h"
+
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+namespace otb
+{
+
+/**
+ * Constructor.
+ */
+template <class TOutputImage>
+SyntheticLatencySource<TOutputImage>::SyntheticLatencySource()
+{
+  m_Size.Fill(1024);
+  m_NumberOfBands = 1;
+  m_Latency = 0;
+  m_Bandwidth = 0;
+  m_Jitter = 0;
+  m_Generator.seed(0);
+  m_NumberOfRequests = 0;
+  m_RequestedBytes = 0;
+}
+
+
+/**
+ * Generate the output image information.
+ */
+template <class TOutputImage>
+void
+SyntheticLatencySource<TOutputImage>::GenerateOutputInformation()
+{
+  RegionType largestRegion;
+  largestRegion.GetModifiableIndex().Fill(0);
+  largestRegion.SetSize(m_Size);
+
+  typename TOutputImage::Pointer outputPtr = this->GetOutput();
+  outputPtr->SetLargestPossibleRegion(largestRegion);
+  outputPtr->SetNumberOfComponentsPerPixel(m_NumberOfBands);
+}
+
+
+/**
+ * Generate the requested region, then wait as long as a remote read would.
+ */
+template <class TOutputImage>
+void
+SyntheticLatencySource<TOutputImage>::GenerateData()
+{
+  auto start{std::chrono::steady_clock::now()};
+
+  typename TOutputImage::Pointer outputPtr = this->GetOutput();
+  const RegionType region = outputPtr->GetRequestedRegion();
+  outputPtr->SetBufferedRegion(region);
+  outputPtr->SetNumberOfComponentsPerPixel(m_NumberOfBands);
+  outputPtr->Allocate();
+
+  ValueType * buffer = outputPtr->GetBufferPointer();
+  itk::ImageRegionIteratorWithIndex<TOutputImage> it(outputPtr, region);
+  for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    for (unsigned int band = 0; band < m_NumberOfBands; ++band)
+      *(buffer++) = PixelValue(it.GetIndex(), band);
+
+  // Latency model
+  const uint64_t bytes = static_cast<uint64_t>(region.GetNumberOfPixels()) * m_NumberOfBands * sizeof(ValueType);
+  double seconds = m_Latency;
+  if (m_Bandwidth > 0)
+    seconds += bytes / m_Bandwidth;
+  if (m_Jitter > 0)
+    seconds += std::uniform_real_distribution<double>(-m_Jitter, m_Jitter)(m_Generator);
+  std::this_thread::sleep_until(start + std::chrono::duration<double>(std::max(seconds, 0.0)));
+
+  m_NumberOfRequests++;
+  m_RequestedBytes += bytes;
+}
+
+
+} // end namespace otb
+
+
+#endif
@@ -0,0 +1,227 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchBlockCache_h
+#define otbPrefetchBlockCache_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+// OTB log
+#include "otbMacro.h"
+#include "itkMacro.h"
+
+// Worker
+#include "otbPrefetchWorker.h"
+
+#include <map>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+namespace otb
+{
+
+/**
+ * \class PrefetchBlockCache
+ * \brief Cache of fixed-size blocks of an image, with a LRU eviction policy.
+ *
+ * The largest possible region of the image is divided into a grid of blocks,
+ * starting at the largest possible region index. Each block is either ready
+ * (its buffer holds the pixels of the block) or pending (its pixels are being
+ * fetched by a worker job). The total size of the blocks is bounded by
+ * `MaxBytes`: when room is needed, the least recently used blocks are evicted.
+ * Pending and pinned blocks are never evicted.
+ *
+ * Missing blocks can be grouped in rectangles of adjacent blocks, so that they
+ * are requested to the upstream pipeline with a few large regions.
+ *
+ * The pixel containers of the removed blocks (and of the buffers given back
+ * with `Recycle()`, e.g. the previous outputs) are kept in a pool, within the
+ * part of the budget that is not used by the blocks, and are recycled for the
+ * next buffers of the same size instead of allocating new ones. Containers
+ * that do not own their pixels (e.g. memory-mapped blocks) are not pooled.
+ *
+ * Blocks are created, pinned and evicted from the calling thread, while
+ * worker threads set the pixels of the pending blocks.
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TImage>
+class ITK_EXPORT PrefetchBlockCache : public itk::Object
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef PrefetchBlockCache            Self;
+  typedef itk::Object                   Superclass;
+  typedef itk::SmartPointer<Self>       Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PrefetchBlockCache, itk::Object);
+
+  /** Images typedefs */
+  typedef TImage                            ImageType;
+  typedef typename ImageType::Pointer       ImagePointer;
+  typedef typename ImageType::PixelContainer        PixelContainerType;
+  typedef typename ImageType::PixelContainerPointer PixelContainerPointer;
+  typedef typename ImageType::IndexType     IndexType;
+  typedef typename ImageType::SizeType      SizeType;
+  typedef typename ImageType::RegionType    RegionType;
+  typedef typename IndexType::IndexValueType IndexValueType;
+  typedef typename std::vector<RegionType>  RegionList;
+
+  itkStaticConstMacro(ImageDimension, unsigned int, RegionType::ImageDimension);
+
+  /** Worker typedefs */
+  typedef typename PrefetchWorker<TImage>::JobPointer JobPointer;
+
+  /* Block of the cache */
+  struct Block {
+    IndexType index;      // index of the block in the grid
+    RegionType region;    // block region, cropped to the largest possible region
+    ImagePointer buffer;  // pixels (null while pending)
+    std::shared_ptr<const void> mapping; // keeps the pixels mapped, when they are read from the disk cache
+    JobPointer job;       // job that fetches the block
+    std::atomic<bool> ready;
+    bool used;            // true once its pixels have been copied to an output
+    unsigned int pins;
+    uint64_t lastUse;
+    uint64_t bytes;
+    typename std::list<std::shared_ptr<Block>>::iterator lruPosition; // position in the LRU list
+  };
+  typedef std::shared_ptr<Block>   BlockPointer;
+  typedef std::vector<BlockPointer> BlockList;
+  typedef std::vector<IndexType>   BlockIndexList;
+
+  /** Geometry of the cache. Changing it clears the cache. */
+  void SetGeometry(const RegionType & largestRegion, const SizeType & blockSize, unsigned int nbOfComponents);
+  itkGetConstReferenceMacro(LargestPossibleRegion, RegionType);
+  itkGetConstReferenceMacro(BlockSize, SizeType);
+
+  /** Bound of the size of the blocks, in bytes */
+  itkSetMacro(MaxBytes, uint64_t);
+  itkGetMacro(MaxBytes, uint64_t);
+
+  /** Current size of the blocks, in bytes */
+  uint64_t GetBytes();
+
+  /** Pixels of the cached or removed blocks that were never used */
+  uint64_t GetUnusedPixels();
+
+  /** Indices of the blocks intersecting a region */
+  BlockIndexList GetBlockIndices(const RegionType & region) const;
+
+  /** Region of a block, cropped to the largest possible region */
+  RegionType GetBlockRegion(const IndexType & index) const;
+
+  /** Bounding region of a list of blocks */
+  RegionType GetBlocksRegion(const BlockIndexList & indices) const;
+
+  /** Size of a region, in bytes */
+  uint64_t GetRegionBytes(const RegionType & region) const;
+
+  /** Group blocks in rectangles of adjacent blocks */
+  std::vector<BlockIndexList> Coalesce(BlockIndexList indices) const;
+
+  /** Current use stamp. Blocks used from now on are protected from eviction by MakeRoom(). */
+  uint64_t GetStamp();
+
+  /** Returns the block, or null if the block is not cached. Found blocks are marked as used now. */
+  BlockPointer Find(const IndexType & index);
+
+  /** Insert a pending block */
+  BlockPointer Insert(const IndexType & index);
+
+  /** New buffer for a region, with a recycled pixel container when possible */
+  ImagePointer NewBuffer(const RegionType & region);
+
+  /** Keep the pixel container of a buffer that is about to be dropped, for
+   * the next buffers of the same size. Containers shared with other buffers
+   * are not recycled. */
+  void Recycle(ImageType * buffer);
+
+  /** Set the pixels of a pending block. Returns false if the block has been
+   * removed meanwhile (the buffer is then recycled). */
+  bool SetReady(const BlockPointer & block, const ImagePointer & buffer);
+
+  /** Remove a block */
+  void Remove(const BlockPointer & block);
+
+  /** Pinned blocks are not evicted */
+  void Pin(const BlockPointer & block);
+  void Unpin(const BlockPointer & block);
+
+  /** Mark a block as copied to an output */
+  void SetUsed(const BlockPointer & block);
+
+  /** Evict blocks (used before protectedStamp) until the given bytes fit in the budget.
+   * Returns false if they do not fit. */
+  bool MakeRoom(uint64_t bytes, uint64_t protectedStamp);
+
+  /** Remove all blocks */
+  void Clear();
+
+protected:
+  PrefetchBlockCache();
+  ~PrefetchBlockCache() {}
+
+  /** Remove a block (the mutex must be locked) */
+  void RemoveBlock(typename std::map<IndexType, BlockPointer>::iterator it);
+
+  /** Pool the pixel container of a buffer (the mutex must be locked) */
+  void RecycleBuffer(ImageType * buffer);
+
+  /** Drop pooled containers that do not fit in the budget (the mutex must be locked) */
+  void TrimPool();
+
+  /* Lexicographic order of the blocks indices */
+  struct IndexCompare {
+    bool operator()(const IndexType & a, const IndexType & b) const
+    {
+      for (int dim = ImageDimension - 1; dim >= 0; --dim)
+        if (a[dim] != b[dim])
+          return a[dim] < b[dim];
+      return false;
+    }
+  };
+
+private:
+  PrefetchBlockCache(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+  std::mutex m_Mutex;
+  std::map<IndexType, BlockPointer, IndexCompare> m_Blocks;
+  std::list<BlockPointer> m_LRU; // blocks from the most to the least recently used
+  RegionType m_LargestPossibleRegion;
+  SizeType m_BlockSize;
+  unsigned int m_NumberOfComponents;
+  uint64_t m_MaxBytes;
+  uint64_t m_Bytes;
+  uint64_t m_Stamp;
+  uint64_t m_UnusedPixels;
+  std::multimap<itk::SizeValueType, PixelContainerPointer> m_Pool; // containers by number of pixels
+  uint64_t m_PoolBytes;
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbPrefetchBlockCache.hxx"
+
+#endif
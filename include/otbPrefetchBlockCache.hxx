@@ -0,0 +1,532 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchBlockCache_txx
+#define otbPrefetchBlockCache_txx
+
+#include "otbPrefetchBlockCache.h"
+
+#include <algorithm>
+
+namespace otb
+{
+
+/**
+ * Constructor.
+ */
+template <class TImage>
+PrefetchBlockCache<TImage>::PrefetchBlockCache()
+{
+  m_LargestPossibleRegion.GetModifiableSize().Fill(0);
+  m_LargestPossibleRegion.GetModifiableIndex().Fill(0);
+  m_BlockSize.Fill(256);
+  m_NumberOfComponents = 1;
+  m_MaxBytes = 256 * 1024 * 1024;
+  m_Bytes = 0;
+  m_Stamp = 0;
+  m_UnusedPixels = 0;
+  m_PoolBytes = 0;
+}
+
+
+/**
+ * Geometry of the cache.
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::SetGeometry(const RegionType & largestRegion, const SizeType & blockSize, unsigned int nbOfComponents)
+{
+  if (largestRegion == m_LargestPossibleRegion && blockSize == m_BlockSize && nbOfComponents == m_NumberOfComponents)
+    return;
+
+  otbDebugMacro(<< "New geometry: largest region start " << largestRegion.GetIndex() << " size " << largestRegion.GetSize() << ", blocks size " << blockSize);
+  Clear();
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_LargestPossibleRegion = largestRegion;
+  m_BlockSize = blockSize;
+  m_NumberOfComponents = nbOfComponents;
+}
+
+
+/**
+ * Current size of the blocks, in bytes.
+ */
+template <class TImage>
+uint64_t
+PrefetchBlockCache<TImage>::GetBytes()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Bytes;
+}
+
+
+/**
+ * Pixels of the cached or removed blocks that were never used.
+ */
+template <class TImage>
+uint64_t
+PrefetchBlockCache<TImage>::GetUnusedPixels()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  uint64_t unusedPixels = m_UnusedPixels;
+  for (auto & it : m_Blocks)
+    if (it.second->ready && !it.second->used)
+      unusedPixels += it.second->region.GetNumberOfPixels();
+  return unusedPixels;
+}
+
+
+/**
+ * Indices of the blocks intersecting a region.
+ */
+template <class TImage>
+typename PrefetchBlockCache<TImage>::BlockIndexList
+PrefetchBlockCache<TImage>::GetBlockIndices(const RegionType & region) const
+{
+  BlockIndexList indices;
+  RegionType cropped(region);
+  if (!cropped.Crop(m_LargestPossibleRegion) || cropped.GetNumberOfPixels() == 0)
+    return indices;
+
+  // Range of blocks in each dimension
+  IndexType first, last;
+  for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+  {
+    const IndexValueType origin = m_LargestPossibleRegion.GetIndex(dim);
+    const IndexValueType blockSize = m_BlockSize[dim];
+    first[dim] = (cropped.GetIndex(dim) - origin) / blockSize;
+    last[dim] = (cropped.GetIndex(dim) + static_cast<IndexValueType>(cropped.GetSize(dim)) - 1 - origin) / blockSize;
+  }
+
+  // Enumerate, x first
+  IndexType index(first);
+  while (true)
+  {
+    indices.push_back(index);
+    unsigned int dim = 0;
+    for (; dim < ImageDimension; ++dim)
+    {
+      if (++index[dim] <= last[dim])
+        break;
+      index[dim] = first[dim];
+    }
+    if (dim == ImageDimension)
+      break;
+  }
+  return indices;
+}
+
+
+/**
+ * Region of a block, cropped to the largest possible region.
+ */
+template <class TImage>
+typename PrefetchBlockCache<TImage>::RegionType
+PrefetchBlockCache<TImage>::GetBlockRegion(const IndexType & index) const
+{
+  RegionType region;
+  for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+  {
+    region.SetIndex(dim, m_LargestPossibleRegion.GetIndex(dim) + index[dim] * static_cast<IndexValueType>(m_BlockSize[dim]));
+    region.SetSize(dim, m_BlockSize[dim]);
+  }
+  region.Crop(m_LargestPossibleRegion);
+  return region;
+}
+
+
+/**
+ * Bounding region of a list of blocks.
+ */
+template <class TImage>
+typename PrefetchBlockCache<TImage>::RegionType
+PrefetchBlockCache<TImage>::GetBlocksRegion(const BlockIndexList & indices) const
+{
+  RegionType region;
+  region.GetModifiableSize().Fill(0);
+  region.GetModifiableIndex().Fill(0);
+  if (indices.empty())
+    return region;
+
+  IndexType start = GetBlockRegion(indices.front()).GetIndex();
+  IndexType end = GetBlockRegion(indices.front()).GetUpperIndex();
+  for (auto & index : indices)
+  {
+    const RegionType blockRegion = GetBlockRegion(index);
+    for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+    {
+      start[dim] = std::min(start[dim], blockRegion.GetIndex(dim));
+      end[dim] = std::max(end[dim], blockRegion.GetUpperIndex()[dim]);
+    }
+  }
+  region.SetIndex(start);
+  for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+    region.SetSize(dim, end[dim] - start[dim] + 1);
+  return region;
+}
+
+
+/**
+ * Size of a region, in bytes.
+ */
+template <class TImage>
+uint64_t
+PrefetchBlockCache<TImage>::GetRegionBytes(const RegionType & region) const
+{
+  return static_cast<uint64_t>(region.GetNumberOfPixels()) * m_NumberOfComponents * sizeof(typename ImageType::InternalPixelType);
+}
+
+
+/**
+ * Group blocks in rectangles of adjacent blocks.
+ * Runs of consecutive blocks along x are built first, then runs spanning the
+ * same blocks along x are merged along y.
+ */
+template <class TImage>
+std::vector<typename PrefetchBlockCache<TImage>::BlockIndexList>
+PrefetchBlockCache<TImage>::Coalesce(BlockIndexList indices) const
+{
+  std::sort(indices.begin(), indices.end(), IndexCompare());
+  indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+  // Runs along x
+  std::vector<BlockIndexList> runs;
+  for (auto & index : indices)
+  {
+    bool extends = false;
+    if (!runs.empty())
+    {
+      const IndexType & previous = runs.back().back();
+      extends = (index[0] == previous[0] + 1);
+      for (unsigned int dim = 1; dim < ImageDimension; ++dim)
+        extends &= (index[dim] == previous[dim]);
+    }
+    if (extends)
+      runs.back().push_back(index);
+    else
+      runs.push_back(BlockIndexList({index}));
+  }
+
+  // Merge the runs along y
+  std::vector<BlockIndexList> rectangles;
+  std::vector<IndexType> rectanglesEnd;
+  for (auto & run : runs)
+  {
+    bool merged = false;
+    for (unsigned int i = 0; i < rectangles.size() && !merged; ++i)
+    {
+      const IndexType & start = rectangles[i].front();
+      const IndexType & end = rectanglesEnd[i];
+      bool sameColumns = (run.front()[0] == start[0] && run.back()[0] == end[0] && run.front()[1] == end[1] + 1);
+      for (unsigned int dim = 2; dim < ImageDimension; ++dim)
+        sameColumns &= (run.front()[dim] == start[dim]);
+      if (sameColumns)
+      {
+        rectangles[i].insert(rectangles[i].end(), run.begin(), run.end());
+        rectanglesEnd[i] = run.back();
+        merged = true;
+      }
+    }
+    if (!merged)
+    {
+      rectangles.push_back(run);
+      rectanglesEnd.push_back(run.back());
+    }
+  }
+  return rectangles;
+}
+
+
+/**
+ * Current use stamp.
+ */
+template <class TImage>
+uint64_t
+PrefetchBlockCache<TImage>::GetStamp()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return ++m_Stamp;
+}
+
+
+/**
+ * Returns the block, or null if the block is not cached.
+ */
+template <class TImage>
+typename PrefetchBlockCache<TImage>::BlockPointer
+PrefetchBlockCache<TImage>::Find(const IndexType & index)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_Blocks.find(index);
+  if (it == m_Blocks.end())
+    return BlockPointer();
+  it->second->lastUse = ++m_Stamp;
+  m_LRU.splice(m_LRU.begin(), m_LRU, it->second->lruPosition);
+  return it->second;
+}
+
+
+/**
+ * Insert a pending block.
+ */
+template <class TImage>
+typename PrefetchBlockCache<TImage>::BlockPointer
+PrefetchBlockCache<TImage>::Insert(const IndexType & index)
+{
+  auto block = std::make_shared<Block>();
+  block->index = index;
+  block->region = GetBlockRegion(index);
+  block->ready = false;
+  block->used = false;
+  block->pins = 0;
+  block->bytes = GetRegionBytes(block->region);
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_Blocks.find(index);
+  if (it != m_Blocks.end())
+    RemoveBlock(it);
+  block->lastUse = ++m_Stamp;
+  m_LRU.push_front(block);
+  block->lruPosition = m_LRU.begin();
+  m_Blocks[index] = block;
+  m_Bytes += block->bytes;
+  TrimPool();
+  return block;
+}
+
+
+/**
+ * New buffer for a region.
+ * A pooled pixel container of the same size is used when available.
+ */
+template <class TImage>
+typename PrefetchBlockCache<TImage>::ImagePointer
+PrefetchBlockCache<TImage>::NewBuffer(const RegionType & region)
+{
+  ImagePointer buffer = ImageType::New();
+  buffer->SetBufferedRegion(region);
+  buffer->SetNumberOfComponentsPerPixel(m_NumberOfComponents);
+
+  PixelContainerPointer container;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto it = m_Pool.find(region.GetNumberOfPixels());
+    if (it != m_Pool.end())
+    {
+      container = it->second;
+      m_Pool.erase(it);
+      m_PoolBytes -= GetRegionBytes(region);
+    }
+  }
+  if (container)
+    buffer->SetPixelContainer(container);
+  else
+    buffer->Allocate();
+  return buffer;
+}
+
+
+/**
+ * Keep the pixel container of a buffer that is about to be dropped.
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::Recycle(ImageType * buffer)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  RecycleBuffer(buffer);
+}
+
+
+/**
+ * Pool the pixel container of a buffer (the mutex must be locked).
+ * Only the containers that are not shared (e.g. grafted to an output), that
+ * own their pixels, that hold exactly the pixels of the buffered region, and
+ * that fit in the unused part of the budget are kept.
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::RecycleBuffer(ImageType * buffer)
+{
+  if (buffer == nullptr || buffer->GetNumberOfComponentsPerPixel() != m_NumberOfComponents)
+    return;
+  PixelContainerType * container = buffer->GetPixelContainer();
+  if (container == nullptr || container->GetReferenceCount() > 1 || !container->GetContainerManageMemory())
+    return;
+
+  const RegionType & region = buffer->GetBufferedRegion();
+  if (container->Size() == 0 || container->Size() != region.GetNumberOfPixels() * m_NumberOfComponents)
+    return;
+  const uint64_t bytes = GetRegionBytes(region);
+  if (m_Bytes + m_PoolBytes + bytes > m_MaxBytes)
+    return;
+  m_Pool.insert(std::make_pair(region.GetNumberOfPixels(), PixelContainerPointer(container)));
+  m_PoolBytes += bytes;
+}
+
+
+/**
+ * Drop the largest pooled containers until blocks and pool fit in the
+ * budget (the mutex must be locked).
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::TrimPool()
+{
+  while (!m_Pool.empty() && m_Bytes + m_PoolBytes > m_MaxBytes)
+  {
+    auto it = std::prev(m_Pool.end());
+    m_PoolBytes -= static_cast<uint64_t>(it->first) * m_NumberOfComponents * sizeof(typename ImageType::InternalPixelType);
+    m_Pool.erase(it);
+  }
+}
+
+
+/**
+ * Set the pixels of a pending block.
+ */
+template <class TImage>
+bool
+PrefetchBlockCache<TImage>::SetReady(const BlockPointer & block, const ImagePointer & buffer)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_Blocks.find(block->index);
+  if (it == m_Blocks.end() || it->second != block)
+  {
+    RecycleBuffer(buffer);
+    return false;
+  }
+  block->buffer = buffer;
+  block->ready = true;
+  return true;
+}
+
+
+/**
+ * Remove a block.
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::Remove(const BlockPointer & block)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_Blocks.find(block->index);
+  if (it != m_Blocks.end() && it->second == block)
+    RemoveBlock(it);
+}
+
+
+/**
+ * Remove a block (the mutex must be locked).
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::RemoveBlock(typename std::map<IndexType, BlockPointer>::iterator it)
+{
+  const BlockPointer & block = it->second;
+  otbDebugMacro(<< "Removing block " << block->index);
+  if (block->ready && !block->used)
+    m_UnusedPixels += block->region.GetNumberOfPixels();
+  m_Bytes -= block->bytes;
+  RecycleBuffer(block->buffer);
+  block->buffer = nullptr;
+  block->mapping = nullptr;
+  m_LRU.erase(block->lruPosition);
+  m_Blocks.erase(it);
+}
+
+
+/**
+ * Pin a block.
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::Pin(const BlockPointer & block)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  block->pins++;
+}
+
+
+/**
+ * Unpin a block.
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::Unpin(const BlockPointer & block)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (block->pins > 0)
+    block->pins--;
+}
+
+
+/**
+ * Mark a block as copied to an output.
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::SetUsed(const BlockPointer & block)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  block->used = true;
+}
+
+
+/**
+ * Evict the least recently used blocks until the given bytes fit in the budget.
+ * Pending and pinned blocks, and blocks used since protectedStamp, are kept.
+ * The blocks are visited from the tail of the LRU list, and the visit stops
+ * at the first protected one, since all the next ones are more recent.
+ */
+template <class TImage>
+bool
+PrefetchBlockCache<TImage>::MakeRoom(uint64_t bytes, uint64_t protectedStamp)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_LRU.end();
+  while (m_Bytes + bytes > m_MaxBytes)
+  {
+    if (it == m_LRU.begin())
+      return false;
+    auto candidate = std::prev(it);
+    const BlockPointer block = *candidate;
+    if (block->lastUse >= protectedStamp)
+      return false;
+    if (!block->ready || block->pins > 0)
+    {
+      it = candidate;
+      continue;
+    }
+    RemoveBlock(m_Blocks.find(block->index));
+  }
+  return true;
+}
+
+
+/**
+ * Remove all blocks.
+ */
+template <class TImage>
+void
+PrefetchBlockCache<TImage>::Clear()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  while (!m_Blocks.empty())
+    RemoveBlock(m_Blocks.begin());
+  m_Pool.clear();
+  m_PoolBytes = 0;
+}
+
+
+} // end namespace otb
+
+
+#endif
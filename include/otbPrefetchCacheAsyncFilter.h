@@ -13,17 +13,39 @@
 
 #include "itkImageSource.h"
 
-// Iterator
-#include "itkImageRegionConstIterator.h"
-#include "itkImageRegionIterator.h"
+// Native blocks size
+#include "otbImageMetadata.h"
+
 
 // OTB log
 #include "otbMacro.h"
 #include "itkMacro.h"
 
-#include <thread>
+// Worker
+#include "otbPrefetchWorker.h"
+
+// Predictors
+#include "otbPrefetchRegionPredictor.h"
+
+// Cache
+#include "otbPrefetchBlockCache.h"
+
+// Telemetry
+#include "otbPrefetchStatistics.h"
+
+// Persistent cache
+#include "otbPrefetchDiskCache.h"
+
 #include <vector>
+#include <set>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <limits>
+#include <memory>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
 
 namespace otb
 {
@@ -35,14 +57,67 @@ namespace otb
  * The filter takes one input image and copies it to the output. This filters 
  * has a thread that prefetches the input image while the downstream filter is 
  * running. To do that, it tries to guess what is the next requested region, 
- * based on the previous one, and the assumption that the next requested region 
- * mostly differs from the previous one, by an offset which is frequently the 
- * same. When the filter fails to guess the right next requested region, this
+ * from the history of the requested regions. The guess is delegated to a
+ * `PrefetchRegionPredictor` (see `SetPredictor()`), by default a
+ * `GridRegionPredictor`. When the filter fails to guess the right next requested region, this
  * is not so bad because it will grab the missing parts during the call to 
  *`GenerateData()` (hence, in a synchronous fashion) before generating the 
  * output image.
  *
- * \ingroup ...
+ * When the streaming plan of the downstream writer is known, the filter can
+ * be given the planned regions (see `SetStreamingPlan()`): they are then
+ * prefetched exactly, and the predictor is only used when the requested
+ * regions do not follow the plan.
+ *
+ * The thread is a long-lived `PrefetchWorker`, fed with a queue of guessed
+ * regions. Several regions can be prefetched ahead: the depth of the queue is
+ * adapted at runtime from the time spent by the upstream pipeline to produce
+ * a region, compared with the time spent by the downstream pipeline between
+ * two calls to `GenerateData()`. The depth is bounded by `MaxDepth`, and by
+ * the `MemoryBudget` (in bytes) allowed for the cache. Guessed regions that do
+ * not match anymore are cancelled, unless they are already being fetched.
+ * When the upstream pipeline fails on a guessed region, its blocks are
+ * dropped and fetched again if they are requested: the error is only raised
+ * by the requests that fail themselves.
+ *
+ * The fetched pixels are kept in a `PrefetchBlockCache` of fixed-size blocks,
+ * aligned on the native blocks of the input when they are known (see
+ * `SetBlockSize()`). A requested region is served from any mix of cached
+ * blocks, and only the missing blocks are requested to the upstream pipeline,
+ * grouped in rectangles. Hence the overlapping requests of downstream
+ * neighborhood filters reuse the cached halos, instead of fetching them again.
+ * Pixels are copied by whole scanlines, and when a single cached block matches
+ * the requested region exactly, its buffer is grafted to the output. The pixel
+ * containers that the pipeline releases from the outputs before each request
+ * are recycled for the next blocks and outputs.
+ *
+ * The filter can prefetch several inputs sharing the same largest possible
+ * region (e.g. the bands or dates of a `ConcatenateImages` or `BandMathX`),
+ * see `SetInput(idx, image)`. There is one output per input. The next
+ * regions are predicted once, and each input has its own worker and cache,
+ * so that the inputs are fetched concurrently. Inputs sharing upstream
+ * filters (e.g. the same image twice, or bands extracted from the same
+ * reader) are fetched in turn, since a filter cannot be updated from two
+ * threads at once. The memory budget is shared
+ * by the caches, in proportion of the pixel size of their input.
+ *
+ * An optional disk cache keeps the fetched blocks across runs (see
+ * `SetDiskCacheDirectory()`). It is only used for the inputs that have an
+ * identifier (e.g. their file name or URL, see `SetInputIdentifier()`): the
+ * blocks are stored under a key made of the identifier, the metadata, the
+ * geometry and the pixel type of the input. The query of an URL (e.g. the
+ * signature of a signed URL, which expires) and the extended filename options
+ * that do not select the pixels are left out of the key, so that the blocks
+ * are found again with a new signature. Blocks missing from the memory
+ * cache are read from the disk cache before being requested upstream, and
+ * the fetched blocks are written to the disk cache by the workers.
+ *
+ * The filter and its workers update a `PrefetchStatistics` (see
+ * `GetStatistics()`), with exact counters and one record per requested
+ * region and per fetch job. When a trace file name is set, the records are
+ * written as a Chrome trace when the filter is destroyed.
+ *
+ * \ingroup OTBPrefetch
  */
 template <class TOutputImage>
 class ITK_EXPORT PrefetchCacheAsyncFilter : public itk::ImageSource<TOutputImage>
@@ -68,31 +143,140 @@ public:
   typedef typename ImageType::RegionType   RegionType;
   typedef typename std::vector<RegionType> RegionList;
 
-  /* Iterators typedefs */
-  typedef typename itk::ImageRegionIterator<TOutputImage> OutputIteratorType;
-  typedef typename itk::ImageRegionConstIterator<TOutputImage> ConstIteratorType;
-  
-  itkGetMacro(ExtraGuesses, float);
-  itkGetMacro(MissedGuesses, float);
-  itkGetMacro(GoodGuesses, float);
-  itkGetMacro(NbOfProcessedPixels, float);
-  
-  /* Region slice 1D */
-  struct RegionSlice1D {
-    RegionSlice1D(int strt, int sz, bool cch): start(strt), size(sz), cached(cch) {};
-    int start;
-    long unsigned int size;
-    bool cached;
+  /** Worker typedefs */
+  typedef PrefetchWorker<TOutputImage>      WorkerType;
+  typedef typename WorkerType::JobPointer   JobPointer;
+
+  /** Cache typedefs */
+  typedef PrefetchBlockCache<TOutputImage>      CacheType;
+  typedef typename CacheType::BlockPointer      BlockPointer;
+  typedef typename CacheType::BlockList         BlockList;
+  typedef typename CacheType::BlockIndexList    BlockIndexList;
+
+  /** Predictors typedefs */
+  typedef PrefetchRegionPredictor<RegionType>    PredictorType;
+  typedef typename PredictorType::Pointer        PredictorPointer;
+  typedef std::vector<PredictorPointer>          PredictorList;
+
+  /** Disk cache typedefs */
+  typedef PrefetchDiskCache              DiskCacheType;
+  typedef DiskCacheType::MappingPointer  MappingPointer;
+
+  /** Statistics typedefs */
+  typedef PrefetchStatistics<RegionType>       StatisticsType;
+  typedef typename StatisticsType::Counter     CounterType;
+
+  /** Performance counters and records. The extra pixels are updated after each request. */
+  itkGetObjectMacro(Statistics, StatisticsType);
+
+  /** Chrome trace file written when the filter is destroyed (none when empty) */
+  itkSetStringMacro(TraceFileName);
+  itkGetStringMacro(TraceFileName);
+
+  /** Maximum number of regions prefetched ahead */
+  itkSetMacro(MaxDepth, unsigned int);
+  itkGetMacro(MaxDepth, unsigned int);
+
+  /** Memory budget (in bytes) for the cache */
+  itkSetMacro(MemoryBudget, uint64_t);
+  itkGetMacro(MemoryBudget, uint64_t);
+
+  /** Current number of regions prefetched ahead */
+  itkGetMacro(Depth, unsigned int);
+
+  /** Size of the cache blocks. When null (the default), the native blocks of
+   * the input are used if they are known, else 256x256 blocks. */
+  itkSetMacro(BlockSize, SizeType);
+  itkGetConstReferenceMacro(BlockSize, SizeType);
+
+  /** Directory of the persistent disk cache (none when empty) */
+  itkSetStringMacro(DiskCacheDirectory);
+  itkGetStringMacro(DiskCacheDirectory);
+
+  /** Bound of the size of the disk cache, in bytes */
+  itkSetMacro(DiskCacheMaxBytes, uint64_t);
+  itkGetMacro(DiskCacheMaxBytes, uint64_t);
+
+  /** Disk cache, once opened (null if it is disabled) */
+  itkGetObjectMacro(DiskCache, DiskCacheType);
+
+  /** Predictor of the next requested regions */
+  itkSetObjectMacro(Predictor, PredictorType);
+  itkGetObjectMacro(Predictor, PredictorType);
+
+  /** Planned output regions of the downstream writer, in their request order
+   * (e.g. the splits of its streaming manager), and padding of the regions by
+   * the downstream neighborhood filters. The planned regions are prefetched
+   * instead of the guessed ones, the current predictor is kept as the fallback
+   * of a `PlanRegionPredictor`. An empty plan restores the fallback predictor. */
+  void SetStreamingPlan(const RegionList & plan, const SizeType & radius);
+
+  void SetStreamingPlan(const RegionList & plan)
+  {
+    SizeType radius;
+    radius.Fill(0);
+    SetStreamingPlan(plan, radius);
+  }
+
+  /** Predictors that only observe the requested regions, to report their hit rates */
+  void AddMonitoredPredictor(PredictorType * predictor)
+  {
+    m_MonitoredPredictors.push_back(predictor);
+  }
+
+  const PredictorList & GetMonitoredPredictors() const
+  {
+    return m_MonitoredPredictors;
+  }
+
+
+  /* Job fetching blocks of the cache */
+  struct BlocksJob {
+    JobPointer job;
+    BlockList blocks;
+  };
+  typedef std::vector<BlocksJob> BlocksJobList;
+
+  /* Prefetched input, with its own worker (hence its own thread) and cache */
+  struct PrefetchedInput {
+    typename ImageType::Pointer image; // kept alive while the worker may fetch it
+    std::string identifier; // e.g. file name or URL, for the disk cache
+    std::string diskKey;    // empty when the disk cache is not used
+    typename WorkerType::Pointer worker;
+    typename CacheType::Pointer cache;
+    BlocksJobList speculativeJobs;
   };
   
   void SetInput(ImageType * input)
   {
-    m_InputImage = input;
+    SetInput(0, input);
   }
+
+  /** Set the input idx. The output idx is its prefetched copy. */
+  void SetInput(unsigned int idx, ImageType * input);
   
-  ImageType * GetInput()
+  ImageType * GetInput(unsigned int idx = 0)
   {
-    return m_InputImage;
+    return idx < m_Inputs.size() ? m_Inputs[idx].image.GetPointer() : nullptr;
+  }
+
+  /** Identifier of the input idx (e.g. its file name or URL). Only the inputs
+   * with an identifier use the disk cache. */
+  void SetInputIdentifier(unsigned int idx, const std::string & identifier);
+
+  unsigned int GetNumberOfInputImages() const
+  {
+    return m_Inputs.size();
+  }
+
+  /** Copy a region between two images whose buffered regions contain it,
+   * with one memcpy per line of the region */
+  static void CopyRegion(const ImageType * source, ImageType * destination, const RegionType & region);
+
+  /** Block cache of the input idx */
+  CacheType * GetCache(unsigned int idx = 0)
+  {
+    return idx < m_Inputs.size() ? m_Inputs[idx].cache.GetPointer() : nullptr;
   }
 
 
@@ -101,16 +285,38 @@ protected:
   ~PrefetchCacheAsyncFilter();
   
   void GenerateOutputInformation(void);
+
+  static void GetUpstreamObjects(itk::DataObject * data, std::set<const itk::Object *> & objects);
+
+  void ShareUpstreamMutexes();
   
-  void GetImageRegion(RegionType & region, typename TOutputImage::Pointer & buffer);
+  void CopyInputRegion(CacheType * cache, const ImageType * inputImage, const RegionType & region, typename TOutputImage::Pointer & buffer);
   
-  bool IsSquare(RegionType & region);
+  SizeType GetCacheBlockSize(const ImageType * inputImage);
   
-  bool GuessNextRegion(RegionType & generatedRegion);
+  BlocksJob FetchBlocks(PrefetchedInput & input, const BlockIndexList & indices, bool urgent);
+
+  std::string GetDiskKey(const ImageType * inputImage, const std::string & identifier);
+
+  static std::string GetStableIdentifier(const std::string & identifier);
+
+  static std::string GetBlockName(const RegionType & region);
+
+  BlockIndexList LoadBlocks(PrefetchedInput & input, const BlockIndexList & indices, BlockList & loadedBlocks);
   
-  void GetNextRegion(RegionType generatedRegion);
+  unsigned int ComputeDepth(const RegionType & generatedRegion);
+
+  void ShareMemoryBudget(const RegionType & generatedRegion);
   
-  RegionList GetMissingRegions(RegionType & outputReqRegion);
+  void UpdatePrefetchedRegions(PrefetchedInput & input, const RegionList & guessedRegions, uint64_t protectedStamp);
+
+  void DropFailedJobs(PrefetchedInput & input);
+
+  uint64_t RefetchBlocks(PrefetchedInput & input, const JobPointer & failedJob, BlockList & blocks);
+
+  void PrepareOutputs();
+
+  bool FillOutput(unsigned int idx, const BlockList & blocks);
 
   void GenerateData();
 
@@ -118,16 +324,21 @@ private:
   PrefetchCacheAsyncFilter(const Self &); // purposely not implemented
   void operator=(const Self &); // purposely not implemented
   
-  ImageType * m_InputImage;
-  std::thread m_Thread;
-  RegionType m_PreviousGeneratedRegion;
-  RegionType m_CachedRegion;
-  typename TOutputImage::Pointer m_CachedBuffer;
-  float m_ExtraGuesses;
-  float m_MissedGuesses;
-  float m_GoodGuesses;
-  float m_NbOfProcessedPixels;
-  float m_WaitSecs;
+  std::vector<PrefetchedInput> m_Inputs;
+  typename StatisticsType::Pointer m_Statistics;
+  std::string m_TraceFileName;
+  std::string m_DiskCacheDirectory;
+  uint64_t m_DiskCacheMaxBytes;
+  DiskCacheType::Pointer m_DiskCache;
+  SizeType m_BlockSize;
+  PredictorPointer m_Predictor;
+  PredictorList m_MonitoredPredictors;
+  unsigned int m_MaxDepth;
+  uint64_t m_MemoryBudget;
+  unsigned int m_Depth;
+  bool m_HasLastExit;
+  std::chrono::steady_clock::time_point m_LastExit;
+  double m_ComputeSecs;
 
   
 }; // end class
@@ -137,4 +348,29 @@ private:
 
 #include "otbPrefetchCacheAsyncFilter.hxx"
 
+// Explicit instantiations for the native pixel types, see otbPrefetchCacheAsyncFilter.cxx
+#include "OTBPrefetchExport.h"
+#include "otbImage.h"
+#include "otbVectorImage.h"
+
+namespace otb
+{
+
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<uint8_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<int16_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<uint16_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<int32_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<uint32_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<float>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<double>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<uint8_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<int16_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<uint16_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<int32_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<uint32_t>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<float>>;
+extern template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<double>>;
+
+} // end namespace otb
+
 #endif
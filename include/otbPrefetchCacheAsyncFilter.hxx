@@ -22,373 +22,982 @@ namespace otb
 template <class TOutputImage>
 PrefetchCacheAsyncFilter<TOutputImage>::PrefetchCacheAsyncFilter()
 {
-  // Set to zero the index and size of the cache image region
-  m_CachedRegion.GetModifiableSize().Fill(0);
-  m_CachedRegion.GetModifiableIndex().Fill(0);
-  
-  // Set to zero metrics accumulators
-  m_MissedGuesses = 0;
-  m_NbOfProcessedPixels = 0;
-  m_ExtraGuesses = 0;
-  m_GoodGuesses = 0;
-  m_WaitSecs = 0;
+  m_Statistics = StatisticsType::New();
+  SetInput(0, nullptr);
+  m_BlockSize.Fill(0);
+  m_Predictor = GridRegionPredictor<RegionType>::New().GetPointer();
+  m_DiskCacheMaxBytes = 4096ull * 1024 * 1024;
+
+  // Prefetch depth
+  m_MaxDepth = 4;
+  m_MemoryBudget = 256 * 1024 * 1024;
+  m_Depth = 1;
+  m_HasLastExit = false;
+  m_ComputeSecs = 0;
 }
 
 
 /**
- * Constructor.
+ * Destructor.
  */
 template <class TOutputImage>
 PrefetchCacheAsyncFilter<TOutputImage>::~PrefetchCacheAsyncFilter()
 {
-  // Wait for the thread to join
-  if (m_Thread.joinable())
-    m_Thread.join();
-
-  // Compute performance metrics
-  float percentMissed = 100 * m_MissedGuesses / m_NbOfProcessedPixels;
-  float percentGood = 100 * m_GoodGuesses / m_NbOfProcessedPixels;
-  float percentExtra = 100 * m_ExtraGuesses / m_NbOfProcessedPixels;
+  // Cancel the pending jobs and wait for the threads to join
+  for (auto & input : m_Inputs)
+    input.worker->Stop();
   
-  // Display metris (todo: remove that and print it from the application)
-  otbWarningMacro(<< m_MissedGuesses << " missing guessed pixels (" << percentMissed << " %)");
-  otbWarningMacro(<< m_GoodGuesses << " good guessed pixels (" << percentGood << " %)");
-  otbWarningMacro(<< m_ExtraGuesses << " extra guessed pixels (" << percentExtra << " %)");
-  otbWarningMacro(<< "Total wait: " << m_WaitSecs << "s");
+  // Cached pixels that were never used
+  uint64_t unusedPixels = 0;
+  for (auto & input : m_Inputs)
+  {
+    input.cache->Clear();
+    unusedPixels += input.cache->GetUnusedPixels();
+  }
+  m_Statistics->Set(CounterType::ExtraPixels, unusedPixels);
+
+  // Destructors must not throw
+  if (!m_TraceFileName.empty())
+  {
+    try
+    {
+      m_Statistics->WriteTrace(m_TraceFileName);
+    }
+    catch (const itk::ExceptionObject & err)
+    {
+      otbWarningMacro(<< err.GetDescription());
+    }
+  }
+}
+
+
+/**
+ * Set an input. Missing inputs are created with their worker, cache and
+ * output.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::SetInput(unsigned int idx, ImageType * input)
+{
+  while (m_Inputs.size() <= idx)
+  {
+    const unsigned int newIdx = m_Inputs.size();
+    PrefetchedInput newInput;
+    newInput.image = nullptr;
+    newInput.worker = WorkerType::New();
+    newInput.worker->SetId(newIdx);
+    newInput.worker->SetStatistics(m_Statistics);
+    newInput.cache = CacheType::New();
+    m_Inputs.push_back(newInput);
+    if (newIdx > 0)
+    {
+      this->SetNumberOfRequiredOutputs(newIdx + 1);
+      this->SetNthOutput(newIdx, this->MakeOutput(newIdx));
+    }
+  }
+  m_Inputs[idx].image = input;
+  this->Modified();
+}
+
+
+/**
+ * Set the identifier of an input.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::SetInputIdentifier(unsigned int idx, const std::string & identifier)
+{
+  if (idx >= m_Inputs.size())
+    itkExceptionMacro(<< "Input " << idx << " is not set");
+  m_Inputs[idx].identifier = identifier;
+  this->Modified();
 }
 
 
 /**
- * Generate the output image information (size, number of channels, etc).
+ * Generate the output images information (size, number of channels, etc).
  */
 template <class TOutputImage>
 void
 PrefetchCacheAsyncFilter<TOutputImage>::GenerateOutputInformation(void)
 {
+  // Disk cache
+  if (!m_DiskCacheDirectory.empty() && (!m_DiskCache || m_DiskCache->GetDirectory() != m_DiskCacheDirectory))
+  {
+    m_DiskCache = DiskCacheType::New();
+    m_DiskCache->SetMaxBytes(m_DiskCacheMaxBytes);
+    if (!m_DiskCache->Open(m_DiskCacheDirectory))
+      m_DiskCache = nullptr;
+  }
+  else if (m_DiskCacheDirectory.empty())
+    m_DiskCache = nullptr;
 
-  typename TOutputImage::Pointer outputPtr = this->GetOutput();
-  unsigned int nBands = GetInput()->GetNumberOfComponentsPerPixel();
-  outputPtr->SetNumberOfComponentsPerPixel(nBands);
-  outputPtr->SetLargestPossibleRegion(GetInput()->GetLargestPossibleRegion());
-  outputPtr->SetOrigin(GetInput()->GetOrigin());
-  outputPtr->SetSignedSpacing(GetInput()->GetSignedSpacing());
-  outputPtr->SetMetaDataDictionary(GetInput()->GetMetaDataDictionary());
+  for (unsigned int idx = 0; idx < m_Inputs.size(); ++idx)
+  {
+    const ImageType * inputImage = GetInput(idx);
+    if (!inputImage)
+      itkExceptionMacro(<< "Input " << idx << " is not set");
+    if (inputImage->GetLargestPossibleRegion() != GetInput()->GetLargestPossibleRegion())
+      itkExceptionMacro(<< "Input " << idx << " largest possible region " << inputImage->GetLargestPossibleRegion() 
+        << " differs from the one of the first input " << GetInput()->GetLargestPossibleRegion());
+
+    ImageType * outputPtr = this->GetOutput(idx);
+    unsigned int nBands = inputImage->GetNumberOfComponentsPerPixel();
+    outputPtr->SetNumberOfComponentsPerPixel(nBands);
+    outputPtr->SetLargestPossibleRegion(inputImage->GetLargestPossibleRegion());
+    outputPtr->SetOrigin(inputImage->GetOrigin());
+    outputPtr->SetSignedSpacing(inputImage->GetSignedSpacing());
+    outputPtr->SetMetaDataDictionary(inputImage->GetMetaDataDictionary());
+
+    // Cache geometry
+    m_Inputs[idx].cache->SetGeometry(inputImage->GetLargestPossibleRegion(), GetCacheBlockSize(inputImage), nBands);
+    m_Inputs[idx].diskKey.clear();
+    if (m_DiskCache && !m_Inputs[idx].identifier.empty())
+      m_Inputs[idx].diskKey = GetDiskKey(inputImage, m_Inputs[idx].identifier);
+  }
+
+  ShareUpstreamMutexes();
+
+  // Predictors bounds
+  m_Predictor->SetLargestPossibleRegion(GetInput()->GetLargestPossibleRegion());
+  for (auto & predictor : m_MonitoredPredictors)
+    predictor->SetLargestPossibleRegion(GetInput()->GetLargestPossibleRegion());
 
 }
 
 
 /**
- * Retrieve a portion of the input image.
- * Modifies the buffer argument.
+ * Collect a data object, its source, and recursively the inputs of the
+ * source.
  */
 template <class TOutputImage>
 void
-PrefetchCacheAsyncFilter<TOutputImage>::GetImageRegion(RegionType & region, typename TOutputImage::Pointer & buffer)
+PrefetchCacheAsyncFilter<TOutputImage>::GetUpstreamObjects(itk::DataObject * data, std::set<const itk::Object *> & objects)
 {
-  otbDebugMacro(<< "Entering GetImageRegion() for region start " << region.GetIndex() << " size " << region.GetSize());
-  
-  // Trigger upstream pipeline
-  otbDebugMacro(<< "Trigger upstream pipeline...");
-  ImageType * inputImage = GetInput();
-  inputImage->SetRequestedRegion(region);
-  inputImage->PropagateRequestedRegion();
-  inputImage->UpdateOutputData();
-  otbDebugMacro(<< "Trigger upstream pipeline...done");
-  
-  unsigned int nBands = inputImage->GetNumberOfComponentsPerPixel();
-  
-  // Copy upstream pipeline result to buffer
-  otbDebugMacro(<< "Copy upstream pipeline result to buffer");
-  buffer = TOutputImage::New();
-  buffer->SetBufferedRegion(region);
-  buffer->SetNumberOfComponentsPerPixel(nBands);
-  buffer->Allocate();
-
-  ConstIteratorType inIt(inputImage, region);
-  OutputIteratorType outIt(buffer, region);
-  for (inIt.GoToBegin(); !inIt.IsAtEnd(); ++inIt, ++outIt)
+  if (!data || !objects.insert(data).second)
+    return;
+  itk::ProcessObject * source = data->GetSource();
+  if (!source || !objects.insert(source).second)
+    return;
+  for (auto & input : source->GetInputs())
+    GetUpstreamObjects(input, objects);
+}
+
+
+/**
+ * Group the inputs that share upstream objects (the same image, or a common
+ * upstream filter), and give the workers of a group the same upstream mutex,
+ * so that they never update the upstream pipeline at the same time.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::ShareUpstreamMutexes()
+{
+  const unsigned int nbOfInputs = m_Inputs.size();
+  std::vector<std::set<const itk::Object *>> upstreams(nbOfInputs);
+  std::vector<unsigned int> groups(nbOfInputs);
+  for (unsigned int idx = 0; idx < nbOfInputs; ++idx)
   {
-    outIt.Set(inIt.Get());
+    GetUpstreamObjects(m_Inputs[idx].image, upstreams[idx]);
+    groups[idx] = idx;
+    for (unsigned int other = 0; other < idx; ++other)
+    {
+      if (groups[other] == groups[idx])
+        continue;
+      const bool shared = std::any_of(upstreams[other].begin(), upstreams[other].end(),
+        [&](const itk::Object * object) { return upstreams[idx].count(object) > 0; });
+      if (!shared)
+        continue;
+
+      // Merge the group of the input into the one of the other input
+      otbDebugMacro(<< "Inputs " << other << " and " << idx << " share upstream filters, they are fetched in turn");
+      const unsigned int merged = groups[idx];
+      for (unsigned int i = 0; i <= idx; ++i)
+        if (groups[i] == merged)
+          groups[i] = groups[other];
+    }
   }
-  otbDebugMacro(<< "Exiting GetImageRegion()");
 
+  // The input a group is labelled with keeps its mutex
+  for (unsigned int idx = 0; idx < nbOfInputs; ++idx)
+    if (groups[idx] != idx)
+      m_Inputs[idx].worker->SetUpstreamMutex(m_Inputs[groups[idx]].worker->GetUpstreamMutex());
 }
 
 
 /**
- * Tell if a region is square
+ * Prefetch the planned regions, falling back to the current predictor.
  */
 template <class TOutputImage>
-bool
-PrefetchCacheAsyncFilter<TOutputImage>::IsSquare(RegionType & region)
+void
+PrefetchCacheAsyncFilter<TOutputImage>::SetStreamingPlan(const RegionList & plan, const SizeType & radius)
 {
-  return region.GetSize(0) == region.GetSize(1);
+  typedef PlanRegionPredictor<RegionType> PlanPredictorType;
+  PredictorPointer fallback = m_Predictor;
+  if (PlanPredictorType * planPredictor = dynamic_cast<PlanPredictorType *>(m_Predictor.GetPointer()))
+    fallback = planPredictor->GetFallback();
+  if (!fallback)
+  {
+    fallback = GridRegionPredictor<RegionType>::New().GetPointer();
+    fallback->SetLargestPossibleRegion(m_Predictor->GetLargestPossibleRegion());
+  }
+
+  if (plan.empty())
+    m_Predictor = fallback;
+  else
+  {
+    typename PlanPredictorType::Pointer planPredictor = PlanPredictorType::New();
+    planPredictor->SetPlan(plan);
+    planPredictor->SetRadius(radius);
+    planPredictor->SetFallback(fallback);
+    planPredictor->SetLargestPossibleRegion(fallback->GetLargestPossibleRegion());
+    m_Predictor = planPredictor.GetPointer();
+  }
+  this->Modified();
 }
 
 
 /**
- * Guess the next input image region.
- * Modifies m_CachedRegion
+ * Size of the cache blocks.
+ * When the block size is not set, the native blocks of the input are used
+ * (a multiple of them when they are thin, like the strips of a stripped
+ * GeoTiff), else 256x256 blocks.
  */
 template <class TOutputImage>
-bool
-PrefetchCacheAsyncFilter<TOutputImage>::GuessNextRegion(RegionType & generatedRegion)
+typename PrefetchCacheAsyncFilter<TOutputImage>::SizeType
+PrefetchCacheAsyncFilter<TOutputImage>::GetCacheBlockSize(const ImageType * inputImage)
 {
+  const itk::SizeValueType defaultBlockSize = 256;
+  const itk::SizeValueType minBlockSize = 64;
+  SizeType blockSize(m_BlockSize);
+  for (unsigned int dim = 0; dim < ImageType::ImageDimension; ++dim)
+    if (blockSize[dim] == 0)
+      blockSize[dim] = defaultBlockSize;
+  if (m_BlockSize[0] != 0 || m_BlockSize[1] != 0)
+    return blockSize;
 
-  otbDebugMacro(<< "Entering GuessNextRegion() for region start " << generatedRegion.GetIndex() << " size " << generatedRegion.GetSize());
+  const ImageMetadata & imd = inputImage->GetImageMetadata();
+  if (imd.Has(MDNum::TileHintX) && imd.Has(MDNum::TileHintY))
+  {
+    SizeType nativeSize;
+    nativeSize.Fill(1);
+    nativeSize[0] = imd[MDNum::TileHintX];
+    nativeSize[1] = imd[MDNum::TileHintY];
+    for (unsigned int dim = 0; dim < 2; ++dim)
+      if (nativeSize[dim] > 0)
+        blockSize[dim] = nativeSize[dim] * ((minBlockSize + nativeSize[dim] - 1) / nativeSize[dim]);
+    otbDebugMacro(<< "Native blocks size: " << nativeSize << ", cache blocks size: " << blockSize);
+  }
+  return blockSize;
+}
 
-  // We assume that the next region will have the same size
-  SizeType size = generatedRegion.GetSize();
 
-  // Compute shift with the previous region
-  auto shift = generatedRegion.GetIndex() - m_PreviousGeneratedRegion.GetIndex();
-  otbDebugMacro(<< "Raw shift: " << shift);
-  
-  auto preStart = m_PreviousGeneratedRegion.GetIndex();
-  otbDebugMacro( "Previous start: " << preStart);
-  auto curStart = generatedRegion.GetIndex();
-  otbDebugMacro( "Current start: " << curStart);
-
-  // When the shift is negative in x, we assume that it's a new line of tiles
-  // thus we use the y value of the shift
-  int shiftValue = (shift[0] <= 0) ? shift[1] : shift[0];
-  otbDebugMacro(<< "Absolute shift value: " << shiftValue);
-  
-  // We assume that the next region will follow the same shift
-  // in a specific dimension (i.e. row or col)
-  unsigned int shiftDim = (preStart[0] == curStart[0]) ? 1 : 0;
-  otbDebugMacro(<< "Shift along dimension " << shiftDim);
-  auto start(curStart);
-  start[shiftDim] += shiftValue;
-  otbDebugMacro(<< "Guessed start: " << start);
-
-  // If the older region is square, but not the one after,
-  // we probably need to skip a row. So we recompute the region
-  // as it will start on a new row
-  bool preSquare = IsSquare(m_PreviousGeneratedRegion);
-  otbDebugMacro(<< "Previous is square: " << preSquare);
-  bool curSquare = IsSquare(generatedRegion);
-  otbDebugMacro(<< "Current is square: " << curSquare);
-  if (preSquare and !curSquare)
+/**
+ * Copy a region between two images whose buffered regions contain it.
+ * The pixels of a line of the region are contiguous in the buffers (all
+ * their components), so each line is copied with a single memcpy. The
+ * offsets of the first line are computed once, the next lines are reached
+ * with the strides of the buffers.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::CopyRegion(const ImageType * source, ImageType * destination, const RegionType & region)
+{
+  typedef typename ImageType::InternalPixelType ValueType;
+  if (region.GetNumberOfPixels() == 0)
+    return;
+
+  const itk::OffsetValueType nBands = source->GetNumberOfComponentsPerPixel();
+  const size_t lineBytes = region.GetSize(0) * nBands * sizeof(ValueType);
+  const itk::OffsetValueType * sourceStrides = source->GetOffsetTable();
+  const itk::OffsetValueType * destinationStrides = destination->GetOffsetTable();
+  const ValueType * sourceBuffer = source->GetBufferPointer();
+  ValueType * destinationBuffer = destination->GetBufferPointer();
+  itk::OffsetValueType sourceOffset = source->ComputeOffset(region.GetIndex()) * nBands;
+  itk::OffsetValueType destinationOffset = destination->ComputeOffset(region.GetIndex()) * nBands;
+
+  // Position of the current line in the region, along the dimensions > 0
+  const itk::SizeValueType nbOfLines = region.GetNumberOfPixels() / region.GetSize(0);
+  SizeType position;
+  position.Fill(0);
+  for (itk::SizeValueType line = 0; line < nbOfLines; ++line)
   {
-    start[0] = 0;
-    start[1] = generatedRegion.GetIndex(1) + shift[0]; // transpose shift
-    size = m_PreviousGeneratedRegion.GetSize();
-    otbDebugMacro(<< "Previous region was square, but not the last. Next might be a square region on a new row. New guessed start: " << start << " size: " << size);
+    std::memcpy(destinationBuffer + destinationOffset, sourceBuffer + sourceOffset, lineBytes);
+    for (unsigned int dim = 1; dim < ImageType::ImageDimension; ++dim)
+    {
+      sourceOffset += sourceStrides[dim] * nBands;
+      destinationOffset += destinationStrides[dim] * nBands;
+      if (++position[dim] < region.GetSize(dim))
+        break;
+      position[dim] = 0;
+      sourceOffset -= region.GetSize(dim) * sourceStrides[dim] * nBands;
+      destinationOffset -= region.GetSize(dim) * destinationStrides[dim] * nBands;
+    }
   }
-  m_CachedRegion = RegionType(start, size);
+}
+
 
-  return m_CachedRegion.Crop(GetInput()->GetLargestPossibleRegion());
+/**
+ * Copy a portion of the input image, once it has been produced by the
+ * upstream pipeline.
+ * Modifies the buffer argument.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::CopyInputRegion(CacheType * cache, const ImageType * inputImage, const RegionType & region, typename TOutputImage::Pointer & buffer)
+{
+  otbDebugMacro(<< "Entering CopyInputRegion() for region start " << region.GetIndex() << " size " << region.GetSize());
   
+  // Copy upstream pipeline result to buffer, by whole scanlines
+  otbDebugMacro(<< "Copy upstream pipeline result to buffer");
+  auto start{std::chrono::steady_clock::now()};
+  typename TOutputImage::Pointer newBuffer = cache->NewBuffer(region);
+  CopyRegion(inputImage, newBuffer, region);
+  buffer = newBuffer;
+  const std::chrono::duration<double> elapsed_seconds{std::chrono::steady_clock::now() - start};
+  m_Statistics->AddSeconds(CounterType::StageNanoseconds, elapsed_seconds.count());
+  otbDebugMacro(<< "Exiting CopyInputRegion()");
+
 }
 
 
 /**
- * Retrieve the next input image region
- * m_CachedRegion, m_CachedBuffer are modified.
+ * Ask the worker of an input to retrieve a rectangle of blocks of the input image.
+ * The blocks are inserted as pending in the cache, and become ready once
+ * the worker has copied their pixels. Urgent blocks are fetched before the
+ * guessed ones. When the input uses the disk cache, the worker also writes
+ * the blocks there, once the job is done so that the request waiting for it
+ * is not delayed. Their pixel containers are held until they are written, so
+ * that they are neither recycled nor grafted to an output meanwhile.
  */
 template <class TOutputImage>
-void
-PrefetchCacheAsyncFilter<TOutputImage>::GetNextRegion(RegionType generatedRegion)
+typename PrefetchCacheAsyncFilter<TOutputImage>::BlocksJob
+PrefetchCacheAsyncFilter<TOutputImage>::FetchBlocks(PrefetchedInput & input, const BlockIndexList & indices, bool urgent)
 {
-  otbDebugMacro(<< "Entering GetNextRegion() for region start " << generatedRegion.GetIndex() << " size " << generatedRegion.GetSize());
+  BlocksJob blocksJob;
+  for (auto & index : indices)
+    blocksJob.blocks.push_back(input.cache->Insert(index));
+  const RegionType region = input.cache->GetBlocksRegion(indices);
+
+  // The job is the only owner of the blocks that have been removed
+  // meanwhile: their pixels are dropped
+  const BlockList blocks(blocksJob.blocks);
+  typename CacheType::Pointer cache = input.cache;
+  WorkerType * worker = input.worker;
+  DiskCacheType::Pointer diskCache = input.diskKey.empty() ? nullptr : m_DiskCache;
+  const std::string diskKey = input.diskKey;
+  blocksJob.job = input.worker->Submit(region, [this, blocks, cache, worker, diskCache, diskKey](const ImageType * inputImage, const RegionType &) {
+    for (auto & block : blocks)
+    {
+      typename TOutputImage::Pointer buffer;
+      CopyInputRegion(cache, inputImage, block->region, buffer);
+      if (diskCache)
+      {
+        typename ImageType::PixelContainerPointer container = buffer->GetPixelContainer();
+        const std::string name = GetBlockName(block->region);
+        const uint64_t bytes = cache->GetRegionBytes(block->region);
+        worker->Defer([diskCache, diskKey, name, container, bytes]() {
+          diskCache->Store(diskKey, name, container->GetBufferPointer(), bytes);
+        });
+      }
+      cache->SetReady(block, buffer);
+    }
+  }, urgent);
+  for (auto & block : blocksJob.blocks)
+    block->job = blocksJob.job;
+  
+  return blocksJob;
+}
 
-  // Guess the next region from the region that just has been generated
-  bool guessed = GuessNextRegion(generatedRegion);
 
-  // Cache the next region
-  if (m_CachedRegion.GetNumberOfPixels() > 0)
+/**
+ * Key of an input in the disk cache.
+ * It hashes the identifier of the input with everything that changes its
+ * pixels: metadata, geometry, number of components and pixel type.
+ */
+template <class TOutputImage>
+std::string
+PrefetchCacheAsyncFilter<TOutputImage>::GetDiskKey(const ImageType * inputImage, const std::string & identifier)
+{
+  typedef typename ImageType::InternalPixelType ValueType;
+  std::ostringstream os;
+  os.precision(17);
+  os << GetStableIdentifier(identifier) << "\n" << inputImage->GetImageMetadata() << "\n"
+     << inputImage->GetLargestPossibleRegion().GetIndex() << inputImage->GetLargestPossibleRegion().GetSize()
+     << inputImage->GetOrigin() << inputImage->GetSignedSpacing() << "\n"
+     << inputImage->GetNumberOfComponentsPerPixel() << "x"
+     << (std::numeric_limits<ValueType>::is_integer ? (std::numeric_limits<ValueType>::is_signed ? "int" : "uint") : "float")
+     << 8 * sizeof(ValueType);
+  const std::string key = DiskCacheType::Hash(os.str());
+  otbDebugMacro(<< "Disk cache key of " << identifier << ": " << key);
+  return key;
+}
+
+
+/**
+ * Identifier of an input, without the parts that change from a run to another
+ * for the same pixels: the query of an URL (e.g. the token and expiry of a
+ * signed URL), and the extended filename options other than the ones
+ * selecting the pixels (bands, subdataset and resolution). The other options
+ * only change the metadata, which is part of the disk key anyway.
+ */
+template <class TOutputImage>
+std::string
+PrefetchCacheAsyncFilter<TOutputImage>::GetStableIdentifier(const std::string & identifier)
+{
+  // Extended filename options: file?&key1=value1&key2=value2
+  std::string name = identifier;
+  std::string options;
+  const std::string::size_type optionsPos = name.find("?&");
+  if (optionsPos != std::string::npos)
   {
-    if (guessed)
+    std::istringstream iss(name.substr(optionsPos + 2));
+    name.erase(optionsPos);
+    std::string option;
+    while (std::getline(iss, option, '&'))
     {
-      otbDebugMacro( << "Caching next guessed region (start " << m_CachedRegion.GetIndex() << " size " << m_CachedRegion.GetSize() << ") ...");
-      GetImageRegion(m_CachedRegion, m_CachedBuffer);
-      otbDebugMacro( << "Caching next guessed region...done");
+      const std::string key = option.substr(0, option.find('='));
+      if (key == "bands" || key == "sdataidx" || key == "resol")
+        options += "&" + option;
     }
-    else
+  }
+
+  // Query of an URL (e.g. /vsicurl/https://host/file.tif?st=...&se=...&sig=...)
+  const std::string::size_type schemePos = name.find("://");
+  if (schemePos != std::string::npos)
+  {
+    const std::string::size_type queryPos = name.find('?', schemePos);
+    if (queryPos != std::string::npos)
+      name.erase(queryPos);
+  }
+
+  return options.empty() ? name : name + "?" + options;
+}
+
+
+/**
+ * Name of a block in the disk cache, from its region.
+ */
+template <class TOutputImage>
+std::string
+PrefetchCacheAsyncFilter<TOutputImage>::GetBlockName(const RegionType & region)
+{
+  std::ostringstream os;
+  for (unsigned int dim = 0; dim < ImageType::ImageDimension; ++dim)
+    os << region.GetIndex(dim) << "_";
+  for (unsigned int dim = 0; dim < ImageType::ImageDimension; ++dim)
+    os << region.GetSize(dim) << (dim + 1 < ImageType::ImageDimension ? "_" : "");
+  return os.str();
+}
+
+
+/**
+ * Read blocks from the disk cache. The pixels of the found blocks are used
+ * in place, from the memory-mapped block files, and the blocks are inserted
+ * as ready in the cache. Returns the indices of the blocks that are not in
+ * the disk cache.
+ */
+template <class TOutputImage>
+typename PrefetchCacheAsyncFilter<TOutputImage>::BlockIndexList
+PrefetchCacheAsyncFilter<TOutputImage>::LoadBlocks(PrefetchedInput & input, const BlockIndexList & indices, BlockList & loadedBlocks)
+{
+  if (input.diskKey.empty() || !m_DiskCache)
+    return indices;
+
+  typedef typename ImageType::InternalPixelType ValueType;
+  BlockIndexList missing;
+  uint64_t loadedPixels = 0;
+  for (auto & index : indices)
+  {
+    const RegionType region = input.cache->GetBlockRegion(index);
+    const uint64_t bytes = input.cache->GetRegionBytes(region);
+    MappingPointer mapping = m_DiskCache->Load(input.diskKey, GetBlockName(region), bytes);
+    if (!mapping)
     {
-      // Reset the cached region so it is not used
-      // when missing regions are computed
-      otbDebugMacro( << "Not able to guess next region. reseting cached region to null.");
-      m_CachedRegion.GetModifiableSize().Fill(0);
-      m_CachedRegion.GetModifiableIndex().Fill(0);
+      missing.push_back(index);
+      continue;
     }
-  }
 
-  // At the end, update the previously generated region
-  m_PreviousGeneratedRegion = RegionType(generatedRegion);
+    // The mapped pixels are only read: the buffer is never grafted to an output
+    typename ImageType::Pointer buffer = ImageType::New();
+    buffer->SetBufferedRegion(region);
+    buffer->SetNumberOfComponentsPerPixel(input.image->GetNumberOfComponentsPerPixel());
+    typename ImageType::PixelContainerPointer container = ImageType::PixelContainer::New();
+    container->SetImportPointer(static_cast<ValueType *>(const_cast<void *>(mapping->data)), bytes / sizeof(ValueType), false);
+    buffer->SetPixelContainer(container);
+    BlockPointer block = input.cache->Insert(index);
+    block->mapping = mapping;
+    input.cache->SetReady(block, buffer);
+    loadedBlocks.push_back(block);
+    loadedPixels += region.GetNumberOfPixels();
+  }
+  m_Statistics->Add(CounterType::DiskPixels, loadedPixels);
+  return missing;
 }
 
+
 /**
- * Retrieve the regions that are missing from the cached image region.
+ * Compute the number of regions to prefetch ahead.
+ * The time needed to fetch the next region (pessimistic estimate: mean plus
+ * twice the mean deviation, for the slowest input since the inputs are
+ * fetched concurrently) is compared with the time spent by the downstream
+ * pipeline between two calls of GenerateData(). The depth is bounded by
+ * m_MaxDepth and by the memory budget.
  */
 template <class TOutputImage>
-typename PrefetchCacheAsyncFilter<TOutputImage>::RegionList
-PrefetchCacheAsyncFilter<TOutputImage>::GetMissingRegions(RegionType & outputReqRegion)
+unsigned int
+PrefetchCacheAsyncFilter<TOutputImage>::ComputeDepth(const RegionType & generatedRegion)
 {
-  otbDebugMacro(
-    << "Entering GetMissingRegions() for region start " << outputReqRegion.GetIndex() << " size " << outputReqRegion.GetSize()
-    << " and the m_CachedRegion start " << m_CachedRegion.GetIndex() << " size " << m_CachedRegion.GetSize()
-  );
-  
-  // This is for statistics and also to check that the cached region touches
-  // the requested one.
-  RegionType forStats(m_CachedRegion);
-  m_NbOfProcessedPixels += outputReqRegion.GetNumberOfPixels();
-  float nbOfCachedPixels = forStats.GetNumberOfPixels();
-  bool touches = forStats.Crop(outputReqRegion);
-  if (touches)
+  unsigned int depth = 1;
+  double fetchSecs = 0;
+  uint64_t regionBytes = 0;
+  for (auto & input : m_Inputs)
   {
-    m_ExtraGuesses += nbOfCachedPixels - forStats.GetNumberOfPixels();
-    m_GoodGuesses += forStats.GetNumberOfPixels();
-    m_MissedGuesses += outputReqRegion.GetNumberOfPixels() - forStats.GetNumberOfPixels();
+    fetchSecs = std::max(fetchSecs, generatedRegion.GetNumberOfPixels() * 
+      (input.worker->GetSecondsPerPixel() + 2.0 * input.worker->GetSecondsPerPixelDeviation()));
+    regionBytes += input.cache->GetRegionBytes(generatedRegion);
   }
-  else
+  if (m_HasLastExit && fetchSecs > 0)
   {
-    m_ExtraGuesses += nbOfCachedPixels;
-    m_MissedGuesses += outputReqRegion.GetNumberOfPixels();
+    const double ratio = fetchSecs / std::max(m_ComputeSecs, 1e-6);
+    depth = static_cast<unsigned int>(std::min(std::ceil(ratio), static_cast<double>(m_MaxDepth)));
   }
   
-  if (m_CachedRegion.IsInside(outputReqRegion))
-    // When the output requested region lies entirely inside the
-    // cached region, there is nothing missing :)
-    return RegionList({});
-  
-  if (m_CachedRegion.GetNumberOfPixels() == 0 || !touches)
-    // When the cached region is empty, it means that there is a single
-    // missing region which is the entire requested region.
-    return RegionList({outputReqRegion});
-  
-  // Else, we collect the missing regions.
-  IndexType outStart = outputReqRegion.GetIndex();
-  IndexType outEnd = outputReqRegion.GetUpperIndex();
-  IndexType cacheStart = m_CachedRegion.GetIndex();
-  IndexType cacheEnd = m_CachedRegion.GetUpperIndex();
+  // Stay within the memory budget (at least one region is prefetched)
+  if (regionBytes > 0)
+    depth = std::min(depth, static_cast<unsigned int>(std::max(m_MemoryBudget / regionBytes, uint64_t(1))));
+  depth = std::max(std::min(depth, m_MaxDepth), 1u);
   
-  RegionList regions;
-  std::vector<std::vector<RegionSlice1D>> dim_splits;
-  for (unsigned int dim = 0; dim < ImageType::ImageDimension; ++dim)
+  otbDebugMacro(<< "Prefetch depth: " << depth << " (fetch: " << fetchSecs << "s, compute: " << m_ComputeSecs << "s)");
+  return depth;
+}
+
+
+/**
+ * Share the memory budget between the caches, in proportion of the size of
+ * the generated region in each input. Since all the inputs are prefetched
+ * for the same regions, they all keep the same number of regions.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::ShareMemoryBudget(const RegionType & generatedRegion)
+{
+  uint64_t regionBytes = 0;
+  for (auto & input : m_Inputs)
+    regionBytes += input.cache->GetRegionBytes(generatedRegion);
+  for (auto & input : m_Inputs)
   {
-    auto rngStart = std::max(outStart[dim], cacheStart[dim]);
-    auto rngEnd   = std::min(outEnd[dim], cacheEnd[dim]);
-    std::vector<RegionSlice1D> splits; 
-    if (outStart[dim] <= rngStart and rngEnd <= outEnd[dim])
-      splits.push_back(RegionSlice1D(rngStart, rngEnd - rngStart + 1, true));
-    if (outStart[dim] < rngStart)
-      splits.push_back(RegionSlice1D(outStart[dim], rngStart - outStart[dim], false));
-    if (rngEnd < outEnd[dim])
-      splits.push_back(RegionSlice1D(rngEnd + 1, outEnd[dim] - rngEnd, false));
-    dim_splits.push_back(splits);
+    if (regionBytes == 0)
+      input.cache->SetMaxBytes(m_MemoryBudget / m_Inputs.size());
+    else
+      input.cache->SetMaxBytes(static_cast<uint64_t>(static_cast<double>(m_MemoryBudget) * 
+        input.cache->GetRegionBytes(generatedRegion) / regionBytes));
+  }
+}
+
+
+/**
+ * Fetch the blocks of the guessed regions that are not cached yet in an input,
+ * as long as they fit in its memory budget. Blocks found in the disk cache
+ * are read from there. Guessed blocks that are already cached are
+ * marked as used, so that they are evicted last. The queued jobs that are not
+ * needed anymore are cancelled: their pending blocks are removed. The ones
+ * already being fetched are kept until they are done.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::UpdatePrefetchedRegions(PrefetchedInput & input, const RegionList & guessedRegions, uint64_t protectedStamp)
+{
+  CacheType * cache = input.cache;
+  DropFailedJobs(input);
+  BlocksJobList speculativeJobs;
+  std::vector<JobPointer> keptJobs;
+  for (auto & region : guessedRegions)
+  {
+    BlockIndexList missing;
+    for (auto & index : cache->GetBlockIndices(region))
+    {
+      BlockPointer block = cache->Find(index);
+      if (!block)
+        missing.push_back(index);
+      else if (!block->ready)
+        keptJobs.push_back(block->job);
+    }
+    if (missing.empty())
+      continue;
+    
+    uint64_t bytes = 0;
+    for (auto & index : missing)
+      bytes += cache->GetRegionBytes(cache->GetBlockRegion(index));
+    if (!cache->MakeRoom(bytes, protectedStamp))
+    {
+      otbDebugMacro( << "Memory budget reached, not caching guessed region (start " << region.GetIndex() << " size " << region.GetSize() << ")");
+      break;
+    }
+    
+    otbDebugMacro( << "Caching next guessed region (start " << region.GetIndex() << " size " << region.GetSize() << ")");
+    BlockList loadedBlocks;
+    missing = LoadBlocks(input, missing, loadedBlocks);
+    for (auto & rectangle : cache->Coalesce(missing))
+      speculativeJobs.push_back(FetchBlocks(input, rectangle, false));
   }
   
-  // Todo: nested loop for generic number of dimensions 
-  // (here only dimension 2 is deals with)
-  for (auto& x_split: dim_splits[0])
-    for (auto& y_split: dim_splits[1])
-      if (!x_split.cached || !y_split.cached)
-        regions.push_back(RegionType(IndexType({x_split.start, y_split.start}), SizeType({x_split.size, y_split.size})));
+  // Stale jobs
+  for (auto & blocksJob : input.speculativeJobs)
+  {
+    if (std::find(keptJobs.begin(), keptJobs.end(), blocksJob.job) != keptJobs.end())
+    {
+      speculativeJobs.push_back(blocksJob);
+      continue;
+    }
+    if (input.worker->Cancel(blocksJob.job, false))
+    {
+      otbDebugMacro( << "Dropping stale region (start " << blocksJob.job->region.GetIndex() << " size " << blocksJob.job->region.GetSize() << ")");
+      for (auto & block : blocksJob.blocks)
+        cache->Remove(block);
+    }
+    else if (input.worker->IsPending(blocksJob.job) || input.worker->HasFailed(blocksJob.job))
+    {
+      // The job is being fetched: it is kept until it is done, so that its
+      // blocks are dropped if it fails
+      speculativeJobs.push_back(blocksJob);
+    }
+  }
   
-  return regions;
+  input.speculativeJobs = speculativeJobs;
 }
 
 
-
 /**
- * Compute the output image on the requested region.
+ * Drop the guessed regions of an input that the upstream pipeline failed to
+ * produce. Their blocks are removed from the cache, so that they are fetched
+ * again when they are requested or guessed.
  */
 template <class TOutputImage>
 void
-PrefetchCacheAsyncFilter<TOutputImage>::GenerateData()
+PrefetchCacheAsyncFilter<TOutputImage>::DropFailedJobs(PrefetchedInput & input)
 {
-  otbDebugMacro(<< "\033[1;31m\nEntering GenerateData()\033[0m\n");
+  BlocksJobList speculativeJobs;
+  for (auto & blocksJob : input.speculativeJobs)
+  {
+    if (!input.worker->HasFailed(blocksJob.job))
+    {
+      speculativeJobs.push_back(blocksJob);
+      continue;
+    }
+    otbWarningMacro(<< "Failed to prefetch region start " << blocksJob.job->region.GetIndex() << " size " 
+      << blocksJob.job->region.GetSize() << ", it will be fetched again if requested");
+    for (auto & block : blocksJob.blocks)
+      input.cache->Remove(block);
+  }
+  input.speculativeJobs = speculativeJobs;
+}
+
+
+/**
+ * Fetch again, as urgent, the blocks of a failed guessed region that are in
+ * the list of blocks of the current request. The list is updated with the new
+ * (pinned) blocks. Returns the number of fetched pixels.
+ */
+template <class TOutputImage>
+uint64_t
+PrefetchCacheAsyncFilter<TOutputImage>::RefetchBlocks(PrefetchedInput & input, const JobPointer & failedJob, BlockList & blocks)
+{
+  DropFailedJobs(input);
+  BlockIndexList indices;
+  for (auto & block : blocks)
+    if (block->job == failedJob)
+    {
+      input.cache->Unpin(block);
+      indices.push_back(block->index);
+    }
 
-  otbDebugMacro(<< "Waiting thread...");
-  if (m_Thread.joinable())
+  uint64_t fetchedPixels = 0;
+  for (auto & rectangle : input.cache->Coalesce(indices))
   {
-    auto start{std::chrono::steady_clock::now()};
-    otbDebugMacro(<< "Thread is running");
-    m_Thread.join();
-    auto end{std::chrono::steady_clock::now()};
-    const std::chrono::duration<float> elapsed_seconds{end - start};
-    m_WaitSecs += elapsed_seconds.count();
+    fetchedPixels += input.cache->GetBlocksRegion(rectangle).GetNumberOfPixels();
+    BlocksJob blocksJob = FetchBlocks(input, rectangle, true);
+    for (auto & newBlock : blocksJob.blocks)
+    {
+      input.cache->Pin(newBlock);
+      for (auto & block : blocks)
+        if (block->job == failedJob && block->index == newBlock->index)
+          block = newBlock;
+    }
   }
-  otbDebugMacro(<< "Waiting thread...done");
+  return fetchedPixels;
+}
 
 
-  // Output pointer and requested region
-  typename TOutputImage::Pointer outputPtr = this->GetOutput();
-  RegionType                     outputReqRegion = outputPtr->GetRequestedRegion();
-  otbDebugMacro(<< "Requested region start " << outputReqRegion.GetIndex() << " size " << outputReqRegion.GetSize());
-    
-  // Find the missing parts i.e. regions outside the cached region
-  RegionList missingRegions = GetMissingRegions(outputReqRegion);
-  std::vector<typename TOutputImage::Pointer> missingBuffers;
-  for (auto region: missingRegions)
+/**
+ * Prepare the outputs for a new request. The pipeline gives each output a
+ * new, empty, pixel container: the previous ones are recycled in the caches,
+ * unless they are still referenced downstream.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::PrepareOutputs()
+{
+  std::vector<typename ImageType::Pointer> previousBuffers;
+  for (unsigned int idx = 0; idx < m_Inputs.size(); ++idx)
   {
-    otbDebugMacro(<< "Missing region start " << region.GetIndex() << " size " << region.GetSize());
-    typename TOutputImage::Pointer buffer;
-    GetImageRegion(region, buffer);
-    missingBuffers.push_back(buffer);
+    ImageType * outputPtr = this->GetOutput(idx);
+    typename ImageType::Pointer buffer = ImageType::New();
+    buffer->SetBufferedRegion(outputPtr->GetBufferedRegion());
+    buffer->SetNumberOfComponentsPerPixel(outputPtr->GetNumberOfComponentsPerPixel());
+    buffer->SetPixelContainer(outputPtr->GetPixelContainer());
+    previousBuffers.push_back(buffer);
   }
-  if (missingRegions.size() == 0)
-    otbDebugMacro(<< "No missing region");
 
-  
-  // Prepare the output buffer
-  otbDebugMacro(<< "Prepare the output buffer");
-  unsigned int nBands = GetInput()->GetNumberOfComponentsPerPixel();
+  Superclass::PrepareOutputs();
+
+  for (unsigned int idx = 0; idx < m_Inputs.size(); ++idx)
+    m_Inputs[idx].cache->Recycle(previousBuffers[idx]);
+}
+
+
+/**
+ * Fill an output with the cached blocks of its input.
+ * When a single block matches the requested region exactly, its buffer is
+ * grafted to the output: returns true. Memory-mapped blocks are never
+ * grafted, since their pixels are read-only, nor the blocks that are still
+ * being written to the disk cache.
+ */
+template <class TOutputImage>
+bool
+PrefetchCacheAsyncFilter<TOutputImage>::FillOutput(unsigned int idx, const BlockList & blocks)
+{
+  CacheType * cache = m_Inputs[idx].cache;
+  ImageType * outputPtr = this->GetOutput(idx);
+  const RegionType outputReqRegion = outputPtr->GetRequestedRegion();
+  unsigned int nBands = GetInput(idx)->GetNumberOfComponentsPerPixel();
+  if (blocks.size() == 1 && blocks.front()->region == outputReqRegion && !blocks.front()->mapping &&
+      blocks.front()->buffer->GetPixelContainer()->GetReferenceCount() == 1)
+  {
+    // The block matches the requested region: its buffer becomes the output
+    // buffer. The block is removed from the cache since its pixels now belong
+    // to the output.
+    otbDebugMacro(<< "Graft the cached block to the output " << idx);
+    const BlockPointer & block = blocks.front();
+    outputPtr->SetBufferedRegion(outputReqRegion);
+    outputPtr->SetNumberOfComponentsPerPixel(nBands);
+    outputPtr->SetPixelContainer(block->buffer->GetPixelContainer());
+    cache->SetUsed(block);
+    cache->Unpin(block);
+    cache->Remove(block);
+    return true;
+  }
+
+  // Prepare the output buffer, with a recycled pixel container when possible
+  otbDebugMacro(<< "Prepare the output buffer " << idx);
+  typename ImageType::Pointer buffer = cache->NewBuffer(outputReqRegion);
   outputPtr->SetBufferedRegion(outputReqRegion);
   outputPtr->SetNumberOfComponentsPerPixel(nBands);
-  outputPtr->Allocate();
-  
-  // Fill
+  outputPtr->SetPixelContainer(buffer->GetPixelContainer());
+
+  // Fill, by whole scanlines
   otbDebugMacro(<< "Fill");
-  RegionList allRegions(missingRegions);
-  std::vector<typename TOutputImage::Pointer> allBuffers(missingBuffers);
+  for (auto & block : blocks)
+  {
+    RegionType region(block->region);
+    region.Crop(outputReqRegion);
+    CopyRegion(block->buffer, outputPtr, region);
+    cache->SetUsed(block);
+    cache->Unpin(block);
+  }
+  otbDebugMacro(<< "Fill complete");
+  return false;
+}
+
 
-  RegionType cachedRegionForOutput(m_CachedRegion);
-  cachedRegionForOutput.Crop(outputReqRegion);
-  if (cachedRegionForOutput.GetNumberOfPixels() > 0)
+/**
+ * Compute the output images on the requested region.
+ */
+template <class TOutputImage>
+void
+PrefetchCacheAsyncFilter<TOutputImage>::GenerateData()
+{
+  otbDebugMacro(<< "\033[1;31m\nEntering GenerateData()\033[0m\n");
+
+  // Time spent by the downstream pipeline since the last call
+  // (exponential moving average)
+  auto enter{std::chrono::steady_clock::now()};
+  if (m_HasLastExit)
   {
-    allRegions.push_back(cachedRegionForOutput);
-    allBuffers.push_back(m_CachedBuffer);
+    const std::chrono::duration<double> computeSecs{enter - m_LastExit};
+    m_ComputeSecs += 0.2 * (computeSecs.count() - m_ComputeSecs);
   }
-  std::vector<ConstIteratorType> allIterators;
-  otbDebugMacro(<< "Prepare allIterators...");
-  for (unsigned int i = 0; i < allBuffers.size(); i++)
+
+  // Start the workers (does nothing if they are already running)
+  for (auto & input : m_Inputs)
+  {
+    input.worker->SetInput(input.image);
+    input.worker->Start();
+  }
+
+  // Requested region of the first output. It drives the predictions, the
+  // other outputs are served on their own requested regions below.
+  RegionType outputReqRegion = this->GetOutput()->GetRequestedRegion();
+  otbDebugMacro(<< "Requested region start " << outputReqRegion.GetIndex() << " size " << outputReqRegion.GetSize());
+  typename StatisticsType::RequestRecord record;
+  record.region = outputReqRegion;
+  record.start = m_Statistics->GetSeconds(enter);
+  record.hitPixels = 0;
+  record.missedPixels = 0;
+  record.fetchedPixels = 0;
+  record.diskPixels = 0;
+  record.grafted = false;
+
+  // Blocks covering the requested region, in each input. The blocks that are
+  // not cached yet are read from the disk cache, or fetched right now, grouped
+  // in rectangles: the workers of the inputs fetch them concurrently. Room is
+  // made for them first, evicting the blocks of the previous requests.
+  ShareMemoryBudget(outputReqRegion);
+  const unsigned int nbOfInputs = m_Inputs.size();
+  std::vector<uint64_t> stamps(nbOfInputs);
+  std::vector<BlockList> blocks(nbOfInputs);
+  for (unsigned int idx = 0; idx < nbOfInputs; ++idx)
   {
-    otbDebugMacro(
-      << "Region " << i << " start " << allRegions[i].GetIndex() << " size " << allRegions[i].GetSize() 
-      << " (number of pixels: " << allRegions[i].GetNumberOfPixels() << ")" << std::endl
-    );
-    ConstIteratorType it(allBuffers[i], allRegions[i]);
-    allIterators.push_back(it);
-    otbDebugMacro(<< "New iterator created");
+    PrefetchedInput & input = m_Inputs[idx];
+    const RegionType reqRegion = this->GetOutput(idx)->GetRequestedRegion();
+    DropFailedJobs(input);
+    stamps[idx] = input.cache->GetStamp();
+    BlockIndexList missing;
+    for (auto & index : input.cache->GetBlockIndices(reqRegion))
+    {
+      BlockPointer block = input.cache->Find(index);
+      RegionType overlap(input.cache->GetBlockRegion(index));
+      overlap.Crop(reqRegion);
+      if (block)
+      {
+        record.hitPixels += overlap.GetNumberOfPixels();
+        if (!block->ready)
+          input.worker->Promote(block->job);
+        blocks[idx].push_back(block);
+      }
+      else
+      {
+        record.missedPixels += overlap.GetNumberOfPixels();
+        missing.push_back(index);
+      }
+    }
+    uint64_t missingBytes = 0;
+    for (auto & index : missing)
+      missingBytes += input.cache->GetRegionBytes(input.cache->GetBlockRegion(index));
+    if (!input.cache->MakeRoom(missingBytes, stamps[idx]))
+      otbDebugMacro(<< "Memory budget exceeded by the requested region in input " << idx);
+    BlockList loadedBlocks;
+    missing = LoadBlocks(input, missing, loadedBlocks);
+    for (auto & block : loadedBlocks)
+      record.diskPixels += block->region.GetNumberOfPixels();
+    blocks[idx].insert(blocks[idx].end(), loadedBlocks.begin(), loadedBlocks.end());
+    for (auto & rectangle : input.cache->Coalesce(missing))
+    {
+      const RegionType region = input.cache->GetBlocksRegion(rectangle);
+      otbDebugMacro(<< "Missing region start " << region.GetIndex() << " size " << region.GetSize() << " in input " << idx);
+      record.fetchedPixels += region.GetNumberOfPixels();
+      BlocksJob blocksJob = FetchBlocks(input, rectangle, true);
+      blocks[idx].insert(blocks[idx].end(), blocksJob.blocks.begin(), blocksJob.blocks.end());
+    }
+    if (missing.size() == 0)
+      otbDebugMacro(<< "No missing region in input " << idx);
+    for (auto & block : blocks[idx])
+      input.cache->Pin(block);
   }
-  OutputIteratorType outIt(outputPtr, outputReqRegion);
-  for (outIt.GoToBegin(); !outIt.IsAtEnd(); ++outIt)
+
+  // Wait for the workers
+  otbDebugMacro(<< "Waiting workers...");
   {
-    for (unsigned int i = 0; i < allBuffers.size(); i++)
+    auto start{std::chrono::steady_clock::now()};
+    try
     {
-      if (allRegions[i].IsInside(outIt.GetIndex()))
+      for (unsigned int idx = 0; idx < nbOfInputs; ++idx)
       {
-        // We can do that since iterators only stay a region
-        // that results from the buffer region clipped with
-        // the outputReqRegion.
-        // When the region is null, the corresponding buffer is
-        // not used.
-        outIt.Set(allIterators[i].Get());
-        ++allIterators[i];
+        bool allReady = false;
+        while (!allReady)
+        {
+          allReady = true;
+          for (auto & block : blocks[idx])
+          {
+            if (block->ready)
+              continue;
+            const JobPointer job = block->job;
+            try
+            {
+              m_Inputs[idx].worker->Wait(job);
+            }
+            catch (...)
+            {
+              // Only the jobs of this request raise their error. The blocks of
+              // a failed guessed region are fetched again: they can be anywhere
+              // in the list, so the wait starts over.
+              if (job->urgent)
+                throw;
+              record.fetchedPixels += RefetchBlocks(m_Inputs[idx], job, blocks[idx]);
+              allReady = false;
+              break;
+            }
+          }
+        }
       }
     }
+    catch (...)
+    {
+      // Do not keep the blocks of a failed job
+      for (unsigned int idx = 0; idx < nbOfInputs; ++idx)
+        for (auto & block : blocks[idx])
+        {
+          m_Inputs[idx].cache->Unpin(block);
+          if (!block->ready)
+            m_Inputs[idx].cache->Remove(block);
+        }
+      throw;
+    }
+    auto end{std::chrono::steady_clock::now()};
+    const std::chrono::duration<double> elapsed_seconds{end - start};
+    record.wait = elapsed_seconds.count();
   }
-  otbDebugMacro(<< "Fill complete");
+  otbDebugMacro(<< "Waiting workers...done");
   
-
-  // Fire and forget
+  auto copyStart{std::chrono::steady_clock::now()};
+  unsigned int nbOfGrafted = 0;
+  for (unsigned int idx = 0; idx < nbOfInputs; ++idx)
+    if (FillOutput(idx, blocks[idx]))
+      nbOfGrafted++;
+  record.grafted = (nbOfGrafted == nbOfInputs);
+  const std::chrono::duration<double> copySecs{std::chrono::steady_clock::now() - copyStart};
+  record.copy = copySecs.count();
+
+  // Fire and forget: queue the next guessed regions, in all the inputs
   otbDebugMacro(<< "Fire and forget");
-  m_Thread = std::thread(&PrefetchCacheAsyncFilter<TOutputImage>::GetNextRegion, this, outputReqRegion);
+  m_Predictor->Observe(outputReqRegion);
+  for (auto & predictor : m_MonitoredPredictors)
+    predictor->Observe(outputReqRegion);
+  m_Depth = ComputeDepth(outputReqRegion);
+  record.depth = m_Depth;
+  record.predictor = m_Predictor->GetPredictorName();
+  record.predictedRegions = m_Predictor->Predict(m_Depth);
+  for (unsigned int idx = 0; idx < nbOfInputs; ++idx)
+    UpdatePrefetchedRegions(m_Inputs[idx], record.predictedRegions, stamps[idx]);
   
+  m_LastExit = std::chrono::steady_clock::now();
+  m_HasLastExit = true;
+
+  // Telemetry
+  const std::chrono::duration<double> totalSecs{m_LastExit - enter};
+  record.duration = totalSecs.count();
+  uint64_t unusedPixels = 0;
+  for (auto & input : m_Inputs)
+    unusedPixels += input.cache->GetUnusedPixels();
+  m_Statistics->AddRequestRecord(record);
+  m_Statistics->Add(CounterType::Requests, 1);
+  m_Statistics->Add(CounterType::ProcessedPixels, static_cast<uint64_t>(outputReqRegion.GetNumberOfPixels()) * nbOfInputs);
+  m_Statistics->Add(CounterType::HitPixels, record.hitPixels);
+  m_Statistics->Add(CounterType::MissedPixels, record.missedPixels);
+  m_Statistics->Add(CounterType::GraftedRequests, nbOfGrafted);
+  m_Statistics->AddSeconds(CounterType::WaitNanoseconds, record.wait);
+  m_Statistics->AddSeconds(CounterType::CopyNanoseconds, record.copy);
+  m_Statistics->Set(CounterType::ExtraPixels, unusedPixels);
 }
 
 
@@ -0,0 +1,138 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchDiskCache_h
+#define otbPrefetchDiskCache_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+// OTB log
+#include "otbMacro.h"
+#include "itkMacro.h"
+
+#include "OTBPrefetchExport.h"
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+namespace otb
+{
+
+/**
+ * \class PrefetchDiskCache
+ * \brief Persistent cache of image blocks in a local directory.
+ *
+ * Each block is stored in its own file, `<directory>/<key>/<block>.blk`,
+ * where the key identifies the image (see `Hash()`) and the block name its
+ * region. A block file has a small header followed by the raw pixels of the
+ * block. Files are written to a temporary file then renamed, so that several
+ * processes can share the same directory.
+ *
+ * Blocks are read by mapping their file in memory: the pixels are copied
+ * from the mapped pages to the outputs, without any intermediate buffer.
+ *
+ * The total size of the block files is bounded by `MaxBytes`. When it is
+ * exceeded, the least recently used block files (by modification time, which
+ * is refreshed when a block is read) are deleted.
+ *
+ * Memory mapping relies on POSIX: on other systems, `Open()` fails and the
+ * disk cache is disabled.
+ *
+ * \ingroup OTBPrefetch
+ */
+class OTBPrefetch_EXPORT PrefetchDiskCache : public itk::Object
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef PrefetchDiskCache             Self;
+  typedef itk::Object                   Superclass;
+  typedef itk::SmartPointer<Self>       Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PrefetchDiskCache, itk::Object);
+
+  /* Memory-mapped block file, unmapped when destroyed */
+  struct Mapping {
+    Mapping(): address(nullptr), length(0), data(nullptr), bytes(0) {};
+    ~Mapping();
+    void * address;
+    size_t length;
+    const void * data;   // pixels of the block
+    uint64_t bytes;
+  };
+  typedef std::shared_ptr<const Mapping> MappingPointer;
+
+  /** Bound of the size of the block files, in bytes */
+  itkSetMacro(MaxBytes, uint64_t);
+  itkGetMacro(MaxBytes, uint64_t);
+
+  /** Directory of the cache */
+  itkGetStringMacro(Directory);
+
+  /** Create the directory if needed, and account the existing block files.
+   * Returns false if the directory cannot be used. */
+  bool Open(const std::string & directory);
+
+  bool IsOpen() const
+  {
+    return !m_Directory.empty();
+  }
+
+  /** Current size of the block files, in bytes */
+  uint64_t GetBytes();
+
+  /** Key of a text (64-bit FNV-1a hash, as hexadecimal digits), stable
+   * across runs and platforms */
+  static std::string Hash(const std::string & text);
+
+  /** Map a block file. Returns null if the block is not cached, or if its
+   * size differs from the given one. */
+  MappingPointer Load(const std::string & key, const std::string & block, uint64_t bytes);
+
+  /** Write a block file, if it does not exist yet. Returns false on failure. */
+  bool Store(const std::string & key, const std::string & block, const void * data, uint64_t bytes);
+
+protected:
+  PrefetchDiskCache();
+  ~PrefetchDiskCache() {}
+
+  /** Path of a block file */
+  std::string GetBlockPath(const std::string & key, const std::string & block) const;
+
+  /** Delete the least recently used block files until they fit in the
+   * budget (the mutex must be locked) */
+  void Evict(uint64_t maxBytes);
+
+  void PrintSelf(std::ostream & os, itk::Indent indent) const override;
+
+private:
+  PrefetchDiskCache(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+  std::mutex m_Mutex;
+  std::string m_Directory;
+  uint64_t m_MaxBytes;
+  uint64_t m_Bytes;
+
+}; // end class
+
+
+} // end namespace otb
+
+#endif
@@ -0,0 +1,448 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchRegionPredictor_h
+#define otbPrefetchRegionPredictor_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+// OTB log
+#include "otbMacro.h"
+#include "itkMacro.h"
+
+#include <vector>
+#include <deque>
+#include <cstdint>
+
+namespace otb
+{
+
+/**
+ * \class PrefetchRegionPredictor
+ * \brief Base class for the predictors of the next requested regions.
+ *
+ * The predictor observes the sequence of the regions requested to the
+ * prefetch filter, and predicts the next ones. Subclasses implement
+ * `PredictNext()`, which guesses the region following a history of
+ * requested regions. Several regions ahead are predicted by chaining the
+ * guesses.
+ *
+ * Each observed region is also compared with the region that was predicted
+ * just before, so that hit rates can be reported for any predictor, even
+ * one that does not drive the prefetching.
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TRegion>
+class ITK_EXPORT PrefetchRegionPredictor : public itk::Object
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef PrefetchRegionPredictor       Self;
+  typedef itk::Object                   Superclass;
+  typedef itk::SmartPointer<Self>       Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PrefetchRegionPredictor, itk::Object);
+
+  /** Regions typedefs */
+  typedef TRegion                           RegionType;
+  typedef typename RegionType::IndexType    IndexType;
+  typedef typename RegionType::SizeType     SizeType;
+  typedef typename RegionType::OffsetType   OffsetType;
+  typedef typename IndexType::IndexValueType IndexValueType;
+  typedef typename std::vector<RegionType>  RegionList;
+  typedef typename std::deque<RegionType>   RegionHistory;
+
+  itkStaticConstMacro(ImageDimension, unsigned int, RegionType::ImageDimension);
+
+  /** Short name of the predictor, used in reports */
+  virtual const char * GetPredictorName() const = 0;
+
+  /** Bounds of the requested regions */
+  itkSetMacro(LargestPossibleRegion, RegionType);
+  itkGetConstReferenceMacro(LargestPossibleRegion, RegionType);
+
+  /** Number of requested regions kept in the history */
+  itkSetMacro(MaxHistoryLength, unsigned int);
+  itkGetMacro(MaxHistoryLength, unsigned int);
+
+  /** Hit statistics */
+  itkGetMacro(NumberOfObservations, uint64_t);
+  itkGetMacro(NumberOfPredictions, uint64_t);
+  itkGetMacro(RequestedPixels, uint64_t);
+  itkGetMacro(PredictedPixels, uint64_t);
+  itkGetMacro(HitPixels, uint64_t);
+
+  /** Ratio of the requested pixels that were predicted */
+  double GetHitRate() const;
+
+  /** Ratio of the predicted pixels that were requested */
+  double GetPrecision() const;
+
+  /** Append a requested region to the history */
+  virtual void Observe(const RegionType & region);
+
+  /** Predict the next regions (at most count) */
+  virtual RegionList Predict(unsigned int count) const;
+
+  /** Clear the history and the statistics */
+  virtual void Reset();
+
+  const RegionHistory & GetHistory() const
+  {
+    return m_History;
+  }
+
+protected:
+  PrefetchRegionPredictor();
+  ~PrefetchRegionPredictor() {}
+
+  /** Guess the region following the history. Returns false if not able to. */
+  virtual bool PredictNext(const RegionHistory & history, RegionType & nextRegion) const = 0;
+
+private:
+  PrefetchRegionPredictor(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+  RegionType m_LargestPossibleRegion;
+  RegionHistory m_History;
+  unsigned int m_MaxHistoryLength;
+  bool m_HasNextRegion;
+  RegionType m_NextRegion;
+  uint64_t m_NumberOfObservations;
+  uint64_t m_NumberOfPredictions;
+  uint64_t m_RequestedPixels;
+  uint64_t m_PredictedPixels;
+  uint64_t m_HitPixels;
+
+}; // end class
+
+
+/**
+ * \class LegacyRegionPredictor
+ * \brief Predicts the next region from the two last requested ones.
+ *
+ * It assumes that the next requested region mostly differs from the last one
+ * by the same offset. When the shift is negative in x, it assumes a new row of
+ * tiles. When the previous region was square but the last one is not, it
+ * assumes that the last tile of a row has been reached, and that the next
+ * tile starts a new row at x = 0.
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TRegion>
+class ITK_EXPORT LegacyRegionPredictor : public PrefetchRegionPredictor<TRegion>
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef LegacyRegionPredictor            Self;
+  typedef PrefetchRegionPredictor<TRegion> Superclass;
+  typedef itk::SmartPointer<Self>          Pointer;
+  typedef itk::SmartPointer<const Self>    ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(LegacyRegionPredictor, PrefetchRegionPredictor);
+
+  typedef typename Superclass::RegionType    RegionType;
+  typedef typename Superclass::RegionHistory RegionHistory;
+
+  const char * GetPredictorName() const override
+  {
+    return "legacy";
+  }
+
+protected:
+  LegacyRegionPredictor() {}
+  ~LegacyRegionPredictor() {}
+
+  bool PredictNext(const RegionHistory & history, RegionType & nextRegion) const override;
+
+  bool IsSquare(const RegionType & region) const;
+
+private:
+  LegacyRegionPredictor(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+}; // end class
+
+
+/**
+ * \class StrideRegionPredictor
+ * \brief Predicts the next region from the periodic pattern of the history.
+ *
+ * The starts of the requested regions are searched for the smallest period p
+ * such that the last region is the one requested p steps before, translated
+ * by a constant offset. The next region is then the one following the region
+ * requested p steps before, translated by the same offset, and cropped to the
+ * largest possible region. This covers strips (p = 1), raster and serpentine
+ * walks over a grid of tiles, including the narrower tiles of the last column
+ * and row. The period found is kept as long as it holds, so that it is only
+ * searched again when the walk changes.
+ *
+ * When no period is found yet (e.g. during the first row of tiles), the last
+ * stride is repeated, and the walk wraps to a new row when it leaves the
+ * largest possible region. The new row starts where the current one started
+ * (or where it ended, for serpentine walks).
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TRegion>
+class ITK_EXPORT StrideRegionPredictor : public PrefetchRegionPredictor<TRegion>
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef StrideRegionPredictor            Self;
+  typedef PrefetchRegionPredictor<TRegion> Superclass;
+  typedef itk::SmartPointer<Self>          Pointer;
+  typedef itk::SmartPointer<const Self>    ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(StrideRegionPredictor, PrefetchRegionPredictor);
+
+  typedef typename Superclass::RegionType     RegionType;
+  typedef typename Superclass::IndexType      IndexType;
+  typedef typename Superclass::SizeType       SizeType;
+  typedef typename Superclass::OffsetType     OffsetType;
+  typedef typename Superclass::IndexValueType IndexValueType;
+  typedef typename Superclass::RegionHistory  RegionHistory;
+
+  const char * GetPredictorName() const override
+  {
+    return "stride";
+  }
+
+  /** Longest period searched in the history */
+  itkSetMacro(MaxPeriod, unsigned int);
+  itkGetMacro(MaxPeriod, unsigned int);
+
+protected:
+  StrideRegionPredictor();
+  ~StrideRegionPredictor() {}
+
+  bool PredictNext(const RegionHistory & history, RegionType & nextRegion) const override;
+
+  /** Period of the history (0 if none) */
+  unsigned int FindPeriod(const RegionHistory & history) const;
+
+  /** Tell if p is a period of the history */
+  bool IsPeriod(const RegionHistory & history, unsigned int p) const;
+
+  /** Repeat the last stride, wrapping at the largest possible region bounds */
+  bool PredictWithWrap(const RegionHistory & history, RegionType & nextRegion) const;
+
+private:
+  StrideRegionPredictor(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+  unsigned int m_MaxPeriod;
+  mutable unsigned int m_Period; // last period found, kept while it holds
+
+}; // end class
+
+
+/**
+ * \class GridRegionPredictor
+ * \brief Predicts the next region as the next tile of an inferred grid.
+ *
+ * The grid is learnt from the history: in each dimension, the step between
+ * two tiles, the size of the requested regions (which can be larger than the
+ * step, when a downstream neighborhood filter pads the requested regions) and
+ * the phase of the grid. The tile indices of the requested regions give the
+ * walk order (rows or columns, raster or serpentine), hence the exact index of
+ * the next tile. The tile is padded and cropped to the largest possible
+ * region, just like the downstream filters do.
+ *
+ * Until the grid can be inferred, the stride predictor is used.
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TRegion>
+class ITK_EXPORT GridRegionPredictor : public StrideRegionPredictor<TRegion>
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef GridRegionPredictor            Self;
+  typedef StrideRegionPredictor<TRegion> Superclass;
+  typedef itk::SmartPointer<Self>        Pointer;
+  typedef itk::SmartPointer<const Self>  ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(GridRegionPredictor, StrideRegionPredictor);
+
+  typedef typename Superclass::RegionType     RegionType;
+  typedef typename Superclass::IndexType      IndexType;
+  typedef typename Superclass::SizeType       SizeType;
+  typedef typename Superclass::IndexValueType IndexValueType;
+  typedef typename Superclass::RegionHistory  RegionHistory;
+
+  itkStaticConstMacro(ImageDimension, unsigned int, RegionType::ImageDimension);
+
+  const char * GetPredictorName() const override
+  {
+    return "grid";
+  }
+
+  /* Grid inferred in one dimension */
+  struct GridAxis {
+    IndexValueType base;   // start of the first tile, before padding
+    IndexValueType step;   // distance between two tiles
+    IndexValueType pad;    // padding of the requested regions
+    IndexValueType count;  // number of tiles
+  };
+
+protected:
+  GridRegionPredictor() {}
+  ~GridRegionPredictor() {}
+
+  bool PredictNext(const RegionHistory & history, RegionType & nextRegion) const override;
+
+  /** Infer the grid in one dimension. Returns false if not able to. */
+  bool InferAxis(const RegionHistory & history, unsigned int dim, GridAxis & axis) const;
+
+  /** Region of a tile */
+  RegionType GetTileRegion(const GridAxis * axes, const IndexType & tile) const;
+
+  /** Index of the tile of a region */
+  IndexType GetTileIndex(const GridAxis * axes, const RegionType & region) const;
+
+private:
+  GridRegionPredictor(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+}; // end class
+
+
+/**
+ * \class PlanRegionPredictor
+ * \brief Predicts the next regions from the streaming plan of the writer.
+ *
+ * Instead of guessing, the predictor is given the planned output regions of
+ * the downstream writer, in their request order (e.g. the splits of its
+ * streaming manager). Each planned region is mapped to the region requested
+ * to the filter: padded by the radius of the downstream neighborhood filters
+ * (the sum of their radii when they are chained), and cropped to the largest
+ * possible region. The next regions are then the ones following the last
+ * requested region in the plan.
+ *
+ * When the requested regions do not follow the plan (e.g. the downstream
+ * pipeline does not stream like planned), the fallback predictor is used. It
+ * observes all the requested regions, so that it is ready to take over. A
+ * warning is emitted the first time a requested region is not in the plan.
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TRegion>
+class ITK_EXPORT PlanRegionPredictor : public PrefetchRegionPredictor<TRegion>
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef PlanRegionPredictor              Self;
+  typedef PrefetchRegionPredictor<TRegion> Superclass;
+  typedef itk::SmartPointer<Self>          Pointer;
+  typedef itk::SmartPointer<const Self>    ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PlanRegionPredictor, PrefetchRegionPredictor);
+
+  typedef typename Superclass::RegionType    RegionType;
+  typedef typename Superclass::SizeType      SizeType;
+  typedef typename Superclass::RegionList    RegionList;
+  typedef typename Superclass::RegionHistory RegionHistory;
+
+  const char * GetPredictorName() const override
+  {
+    return "plan";
+  }
+
+  /** Planned output regions, in their request order */
+  void SetPlan(const RegionList & plan);
+
+  const RegionList & GetPlan() const
+  {
+    return m_Plan;
+  }
+
+  /** Padding of the planned regions */
+  itkSetMacro(Radius, SizeType);
+  itkGetConstReferenceMacro(Radius, SizeType);
+
+  /** Predictor used when the requested regions do not follow the plan */
+  itkSetObjectMacro(Fallback, Superclass);
+  itkGetObjectMacro(Fallback, Superclass);
+
+  /** Tell if the last requested region is in the plan */
+  bool IsOnPlan() const
+  {
+    return m_Position < m_Plan.size();
+  }
+
+  /** Requested pixels of the regions found in the plan */
+  itkGetMacro(PlanHitPixels, uint64_t);
+
+  void Observe(const RegionType & region) override;
+
+  RegionList Predict(unsigned int count) const override;
+
+  void Reset() override;
+
+protected:
+  PlanRegionPredictor();
+  ~PlanRegionPredictor() {}
+
+  /** Region following the last observed one. Predict() does not chain the
+   * guesses, hence the history is only the one of the observed regions. */
+  bool PredictNext(const RegionHistory & history, RegionType & nextRegion) const override;
+
+  /** Region requested to the filter for a planned region */
+  RegionType GetRequestedRegion(size_t position) const;
+
+  /** Position of a requested region in the plan, searched from the given
+   * position then from the start (the size of the plan if not found) */
+  size_t Find(const RegionType & region, size_t from) const;
+
+private:
+  PlanRegionPredictor(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+  RegionList m_Plan;
+  SizeType m_Radius;
+  typename Superclass::Pointer m_Fallback;
+  size_t m_Position;
+  uint64_t m_PlanHitPixels;
+  bool m_OffPlanWarned;
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbPrefetchRegionPredictor.hxx"
+
+#endif
@@ -0,0 +1,783 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchRegionPredictor_txx
+#define otbPrefetchRegionPredictor_txx
+
+#include "otbPrefetchRegionPredictor.h"
+
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+
+namespace otb
+{
+
+/**
+ * Constructor.
+ */
+template <class TRegion>
+PrefetchRegionPredictor<TRegion>::PrefetchRegionPredictor()
+{
+  m_LargestPossibleRegion.GetModifiableSize().Fill(0);
+  m_LargestPossibleRegion.GetModifiableIndex().Fill(0);
+  m_MaxHistoryLength = 1024;
+  m_HasNextRegion = false;
+
+  // Set to zero metrics accumulators
+  m_NumberOfObservations = 0;
+  m_NumberOfPredictions = 0;
+  m_RequestedPixels = 0;
+  m_PredictedPixels = 0;
+  m_HitPixels = 0;
+}
+
+
+/**
+ * Ratio of the requested pixels that were predicted.
+ */
+template <class TRegion>
+double
+PrefetchRegionPredictor<TRegion>::GetHitRate() const
+{
+  return m_RequestedPixels > 0 ? static_cast<double>(m_HitPixels) / m_RequestedPixels : 0.0;
+}
+
+
+/**
+ * Ratio of the predicted pixels that were requested.
+ */
+template <class TRegion>
+double
+PrefetchRegionPredictor<TRegion>::GetPrecision() const
+{
+  return m_PredictedPixels > 0 ? static_cast<double>(m_HitPixels) / m_PredictedPixels : 0.0;
+}
+
+
+/**
+ * Append a requested region to the history.
+ * The region is first compared with the one that was predicted.
+ */
+template <class TRegion>
+void
+PrefetchRegionPredictor<TRegion>::Observe(const RegionType & region)
+{
+  otbDebugMacro(<< "Observe region start " << region.GetIndex() << " size " << region.GetSize());
+
+  m_NumberOfObservations++;
+  m_RequestedPixels += region.GetNumberOfPixels();
+  if (m_HasNextRegion)
+  {
+    m_NumberOfPredictions++;
+    m_PredictedPixels += m_NextRegion.GetNumberOfPixels();
+    RegionType hit(m_NextRegion);
+    if (hit.Crop(region))
+      m_HitPixels += hit.GetNumberOfPixels();
+  }
+
+  m_History.push_back(region);
+  while (m_History.size() > std::max(m_MaxHistoryLength, 2u))
+    m_History.pop_front();
+
+  m_HasNextRegion = PredictNext(m_History, m_NextRegion) && m_NextRegion.GetNumberOfPixels() > 0;
+}
+
+
+/**
+ * Predict the next regions, by chaining the guesses.
+ */
+template <class TRegion>
+typename PrefetchRegionPredictor<TRegion>::RegionList
+PrefetchRegionPredictor<TRegion>::Predict(unsigned int count) const
+{
+  RegionList predictedRegions;
+  RegionHistory history(m_History);
+  for (unsigned int i = 0; i < count; i++)
+  {
+    RegionType nextRegion;
+    if (!PredictNext(history, nextRegion) || nextRegion.GetNumberOfPixels() == 0)
+      break;
+    predictedRegions.push_back(nextRegion);
+    history.push_back(nextRegion);
+  }
+  return predictedRegions;
+}
+
+
+/**
+ * Clear the history and the statistics.
+ */
+template <class TRegion>
+void
+PrefetchRegionPredictor<TRegion>::Reset()
+{
+  m_History.clear();
+  m_HasNextRegion = false;
+  m_NumberOfObservations = 0;
+  m_NumberOfPredictions = 0;
+  m_RequestedPixels = 0;
+  m_PredictedPixels = 0;
+  m_HitPixels = 0;
+}
+
+
+/**
+ * Tell if a region is square
+ */
+template <class TRegion>
+bool
+LegacyRegionPredictor<TRegion>::IsSquare(const RegionType & region) const
+{
+  return region.GetSize(0) == region.GetSize(1);
+}
+
+
+/**
+ * Guess the next input image region, from the two last generated ones.
+ */
+template <class TRegion>
+bool
+LegacyRegionPredictor<TRegion>::PredictNext(const RegionHistory & history, RegionType & nextRegion) const
+{
+  if (history.empty())
+    return false;
+
+  // Before the second region, the previous region is null
+  RegionType previousRegion;
+  previousRegion.GetModifiableSize().Fill(0);
+  previousRegion.GetModifiableIndex().Fill(0);
+  if (history.size() > 1)
+    previousRegion = history[history.size() - 2];
+  const RegionType & generatedRegion = history.back();
+
+  otbDebugMacro(<< "Entering PredictNext() for region start " << generatedRegion.GetIndex() << " size " << generatedRegion.GetSize());
+
+  // We assume that the next region will have the same size
+  auto size = generatedRegion.GetSize();
+
+  // Compute shift with the previous region
+  auto shift = generatedRegion.GetIndex() - previousRegion.GetIndex();
+  otbDebugMacro(<< "Raw shift: " << shift);
+
+  auto preStart = previousRegion.GetIndex();
+  otbDebugMacro( "Previous start: " << preStart);
+  auto curStart = generatedRegion.GetIndex();
+  otbDebugMacro( "Current start: " << curStart);
+
+  // When the shift is negative in x, we assume that it's a new line of tiles
+  // thus we use the y value of the shift
+  int shiftValue = (shift[0] <= 0) ? shift[1] : shift[0];
+  otbDebugMacro(<< "Absolute shift value: " << shiftValue);
+
+  // We assume that the next region will follow the same shift
+  // in a specific dimension (i.e. row or col)
+  unsigned int shiftDim = (preStart[0] == curStart[0]) ? 1 : 0;
+  otbDebugMacro(<< "Shift along dimension " << shiftDim);
+  auto start(curStart);
+  start[shiftDim] += shiftValue;
+  otbDebugMacro(<< "Guessed start: " << start);
+
+  // If the older region is square, but not the one after,
+  // we probably need to skip a row. So we recompute the region
+  // as it will start on a new row
+  bool preSquare = IsSquare(previousRegion);
+  otbDebugMacro(<< "Previous is square: " << preSquare);
+  bool curSquare = IsSquare(generatedRegion);
+  otbDebugMacro(<< "Current is square: " << curSquare);
+  if (preSquare and !curSquare)
+  {
+    start[0] = 0;
+    start[1] = generatedRegion.GetIndex(1) + shift[0]; // transpose shift
+    size = previousRegion.GetSize();
+    otbDebugMacro(<< "Previous region was square, but not the last. Next might be a square region on a new row. New guessed start: " << start << " size: " << size);
+  }
+  nextRegion = RegionType(start, size);
+
+  return nextRegion.Crop(this->GetLargestPossibleRegion());
+}
+
+
+/**
+ * Constructor.
+ */
+template <class TRegion>
+StrideRegionPredictor<TRegion>::StrideRegionPredictor()
+{
+  m_MaxPeriod = 512;
+  m_Period = 0;
+}
+
+
+/**
+ * Tell if p is a period of the history: the p+1 last regions are the regions
+ * requested p steps before, translated by a constant offset.
+ */
+template <class TRegion>
+bool
+StrideRegionPredictor<TRegion>::IsPeriod(const RegionHistory & history, unsigned int p) const
+{
+  const unsigned int n = history.size();
+  if (p == 0 || n < 2 * p + 1)
+    return false;
+
+  const OffsetType translation = history[n - 1].GetIndex() - history[n - 1 - p].GetIndex();
+  for (unsigned int i = n - 1 - p; i < n - 1; i++)
+    if (history[i].GetIndex() - history[i - p].GetIndex() != translation)
+      return false;
+  return true;
+}
+
+
+/**
+ * Period of the history (0 if none). The last period found is kept as long
+ * as it holds, which is checked in O(p): the periods are only searched again
+ * (smallest first) when the walk changes. This keeps the search off the
+ * chained predictions, which follow the period by construction.
+ */
+template <class TRegion>
+unsigned int
+StrideRegionPredictor<TRegion>::FindPeriod(const RegionHistory & history) const
+{
+  const unsigned int n = history.size();
+  if (n < 3)
+    return 0;
+
+  const unsigned int maxPeriod = std::min(m_MaxPeriod, (n - 1) / 2);
+  if (m_Period > 0 && m_Period <= maxPeriod && IsPeriod(history, m_Period))
+    return m_Period;
+
+  m_Period = 0;
+  for (unsigned int p = 1; p <= maxPeriod; p++)
+    if (IsPeriod(history, p))
+    {
+      m_Period = p;
+      break;
+    }
+  return m_Period;
+}
+
+
+/**
+ * Guess the next input image region.
+ */
+template <class TRegion>
+bool
+StrideRegionPredictor<TRegion>::PredictNext(const RegionHistory & history, RegionType & nextRegion) const
+{
+  if (history.empty())
+    return false;
+
+  const unsigned int n = history.size();
+  const unsigned int period = FindPeriod(history);
+  if (period > 0)
+  {
+    // Region following the one requested a period ago, translated
+    const OffsetType translation = history[n - 1].GetIndex() - history[n - 1 - period].GetIndex();
+    const RegionType & reference = history[n - period];
+    nextRegion = RegionType(reference.GetIndex() + translation, reference.GetSize());
+    otbDebugMacro(<< "Period " << period << ", translation " << translation << ", guessed start " << nextRegion.GetIndex() << " size " << nextRegion.GetSize());
+    if (nextRegion.Crop(this->GetLargestPossibleRegion()))
+      return true;
+  }
+
+  return PredictWithWrap(history, nextRegion);
+}
+
+
+/**
+ * Guess the next input image region by repeating the last stride.
+ * When the region leaves the largest possible region, a new row is started.
+ */
+template <class TRegion>
+bool
+StrideRegionPredictor<TRegion>::PredictWithWrap(const RegionHistory & history, RegionType & nextRegion) const
+{
+  const unsigned int n = history.size();
+  const unsigned int dimension = RegionType::ImageDimension;
+  const RegionType & last = history.back();
+
+  // Number of dimensions where two regions starts differ
+  auto nbOfShiftedDims = [dimension](const OffsetType & offset) {
+    unsigned int nb = 0;
+    for (unsigned int dim = 0; dim < dimension; ++dim)
+      nb += (offset[dim] != 0);
+    return nb;
+  };
+
+  // The "fast" dimension of the walk is the one with the most moves along a
+  // single dimension, the stride is the latest of these moves
+  std::vector<unsigned int> nbOfMoves(dimension, 0);
+  for (unsigned int i = 1; i < n; ++i)
+  {
+    const OffsetType shift = history[i].GetIndex() - history[i - 1].GetIndex();
+    if (nbOfShiftedDims(shift) == 1)
+      for (unsigned int dim = 0; dim < dimension; ++dim)
+        nbOfMoves[dim] += (shift[dim] != 0);
+  }
+  const unsigned int fastDim = std::max_element(nbOfMoves.begin(), nbOfMoves.end()) - nbOfMoves.begin();
+  OffsetType stride;
+  stride.Fill(0);
+  stride[fastDim] = last.GetSize(fastDim);
+  for (unsigned int i = n - 1; i > 0; --i)
+  {
+    const OffsetType shift = history[i].GetIndex() - history[i - 1].GetIndex();
+    if (nbOfShiftedDims(shift) == 1 && shift[fastDim] != 0)
+    {
+      stride = shift;
+      break;
+    }
+  }
+
+  // Latest change of row, along a "slow" dimension
+  int wrapIndex = -1;
+  for (unsigned int i = n - 1; i > 0 && wrapIndex < 0; --i)
+  {
+    const OffsetType shift = history[i].GetIndex() - history[i - 1].GetIndex();
+    for (unsigned int dim = 0; dim < dimension; ++dim)
+      if (dim != fastDim && shift[dim] != 0)
+        wrapIndex = i;
+  }
+
+  // Same region twice: the next one is probably the same again
+  if (n > 1 && history[n - 1] == history[n - 2])
+  {
+    nextRegion = last;
+    return true;
+  }
+
+  // Serpentine walks start the new row where the previous one ended
+  bool serpentine = false;
+  unsigned int slowDim = (fastDim + 1) % dimension;
+  IndexValueType slowStep = last.GetSize(slowDim);
+  if (wrapIndex > 0)
+  {
+    const IndexType & wrapStart = history[wrapIndex].GetIndex();
+    const IndexType & wrapEnd = history[wrapIndex - 1].GetIndex();
+    serpentine = (wrapStart[fastDim] == wrapEnd[fastDim]);
+    for (unsigned int dim = 0; dim < dimension; ++dim)
+      if (dim != fastDim && wrapStart[dim] != wrapEnd[dim])
+      {
+        slowDim = dim;
+        slowStep = wrapStart[dim] - wrapEnd[dim];
+      }
+  }
+
+  // First region of the current row
+  unsigned int rowStart = n - 1;
+  while (rowStart > 0)
+  {
+    const OffsetType shift = history[rowStart].GetIndex() - history[rowStart - 1].GetIndex();
+    if (nbOfShiftedDims(shift) != 1 || shift[fastDim] == 0)
+      break;
+    rowStart--;
+  }
+
+  // Direction of the current row: when the row has just started, it is the
+  // one of the previous row (reversed for serpentine walks)
+  if (rowStart == n - 1 && serpentine)
+    stride[fastDim] = -stride[fastDim];
+
+  // Continue the row
+  nextRegion = RegionType(last.GetIndex() + stride, last.GetSize());
+  otbDebugMacro(<< "Stride " << stride << ", guessed start " << nextRegion.GetIndex() << " size " << nextRegion.GetSize());
+  if (nextRegion.Crop(this->GetLargestPossibleRegion()))
+    return true;
+
+  // Start a new row
+  const RegionType & first = history[rowStart];
+  IndexType start(serpentine ? last.GetIndex() : first.GetIndex());
+  start[slowDim] = last.GetIndex(slowDim) + slowStep;
+  nextRegion = RegionType(start, serpentine ? last.GetSize() : first.GetSize());
+  otbDebugMacro(<< "New row, guessed start " << nextRegion.GetIndex() << " size " << nextRegion.GetSize());
+  return nextRegion.Crop(this->GetLargestPossibleRegion());
+}
+
+
+/**
+ * Infer the grid in one dimension.
+ */
+template <class TRegion>
+bool
+GridRegionPredictor<TRegion>::InferAxis(const RegionHistory & history, unsigned int dim, GridAxis & axis) const
+{
+  const RegionType & largest = this->GetLargestPossibleRegion();
+  const IndexValueType lprStart = largest.GetIndex(dim);
+  const IndexValueType lprEnd = lprStart + static_cast<IndexValueType>(largest.GetSize(dim));
+
+  // Most frequent value (the smallest one, when tied)
+  auto mode = [](const std::map<IndexValueType, unsigned int> & counts) {
+    IndexValueType value = 0;
+    unsigned int best = 0;
+    for (auto & count : counts)
+      if (count.second > best)
+      {
+        value = count.first;
+        best = count.second;
+      }
+    return value;
+  };
+
+  // Steps between regions which are not cropped at the start, and sizes of
+  // regions which are not cropped at all
+  std::map<IndexValueType, unsigned int> steps;
+  std::map<IndexValueType, unsigned int> sizes;
+  bool constant = true;
+  IndexValueType origin = lprStart;
+  for (unsigned int i = 0; i < history.size(); ++i)
+  {
+    const IndexValueType start = history[i].GetIndex(dim);
+    const IndexValueType end = start + static_cast<IndexValueType>(history[i].GetSize(dim));
+    if (start > lprStart)
+    {
+      origin = start;
+      if (end < lprEnd)
+        sizes[end - start]++;
+    }
+    if (i > 0)
+    {
+      const IndexValueType previousStart = history[i - 1].GetIndex(dim);
+      constant &= (start == previousStart && history[i].GetSize(dim) == history[i - 1].GetSize(dim));
+      if (start > lprStart && previousStart > lprStart && start != previousStart)
+        steps[std::abs(start - previousStart)]++;
+    }
+  }
+
+  // All regions span the largest possible region: a single tile
+  const RegionType & last = history.back();
+  if (constant && last.GetIndex(dim) == lprStart && last.GetIndex(dim) + static_cast<IndexValueType>(last.GetSize(dim)) == lprEnd)
+  {
+    axis.base = lprStart;
+    axis.step = lprEnd - lprStart;
+    axis.pad = 0;
+    axis.count = 1;
+    return true;
+  }
+  if (steps.empty())
+    return false;
+
+  axis.step = mode(steps);
+  axis.pad = 0;
+  if (!sizes.empty())
+  {
+    const IndexValueType padding = mode(sizes) - axis.step;
+    if (padding < 0 || padding % 2 != 0)
+      return false;
+    axis.pad = padding / 2;
+  }
+
+  // Phase of the grid, so that the first tile starts at or before the
+  // largest possible region
+  IndexValueType phase = (origin + axis.pad - lprStart) % axis.step;
+  if (phase < 0)
+    phase += axis.step;
+  axis.base = lprStart + phase - (phase > 0 ? axis.step : 0);
+  axis.count = (lprEnd - axis.base + axis.step - 1) / axis.step;
+
+  otbDebugMacro(<< "Axis " << dim << ": base " << axis.base << " step " << axis.step << " pad " << axis.pad << " count " << axis.count);
+  return true;
+}
+
+
+/**
+ * Region of a tile, padded and cropped like the downstream filters do.
+ */
+template <class TRegion>
+typename GridRegionPredictor<TRegion>::RegionType
+GridRegionPredictor<TRegion>::GetTileRegion(const GridAxis * axes, const IndexType & tile) const
+{
+  RegionType region;
+  for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+  {
+    region.SetIndex(dim, axes[dim].base + tile[dim] * axes[dim].step - axes[dim].pad);
+    region.SetSize(dim, axes[dim].step + 2 * axes[dim].pad);
+  }
+  if (!region.Crop(this->GetLargestPossibleRegion()))
+    region.GetModifiableSize().Fill(0);
+  return region;
+}
+
+
+/**
+ * Index of the tile of a region.
+ */
+template <class TRegion>
+typename GridRegionPredictor<TRegion>::IndexType
+GridRegionPredictor<TRegion>::GetTileIndex(const GridAxis * axes, const RegionType & region) const
+{
+  IndexType tile;
+  for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+  {
+    const IndexValueType position = region.GetIndex(dim) + axes[dim].pad - axes[dim].base;
+    tile[dim] = std::max(position, IndexValueType(0)) / axes[dim].step;
+  }
+  return tile;
+}
+
+
+/**
+ * Guess the next input image region.
+ */
+template <class TRegion>
+bool
+GridRegionPredictor<TRegion>::PredictNext(const RegionHistory & history, RegionType & nextRegion) const
+{
+  if (history.empty())
+    return false;
+
+  // Infer the grid, and check that the last region is one of its tiles
+  GridAxis axes[ImageDimension];
+  for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+    if (!InferAxis(history, dim, axes[dim]))
+      return Superclass::PredictNext(history, nextRegion);
+  const IndexType last = GetTileIndex(axes, history.back());
+  if (GetTileRegion(axes, last) != history.back())
+  {
+    otbDebugMacro(<< "Last region does not match the inferred grid");
+    return Superclass::PredictNext(history, nextRegion);
+  }
+
+  // Walk order, from the tile indices of the history: the dimension with the
+  // most moves of one tile gives the rows, the latest of these moves gives the
+  // direction, and the latest move along another dimension gives the row change.
+  const unsigned int n = history.size();
+  std::vector<IndexType> tiles;
+  for (auto & region : history)
+    tiles.push_back(GetTileIndex(axes, region));
+  auto isMove = [&tiles](unsigned int i, unsigned int dim) {
+    for (unsigned int d = 0; d < ImageDimension; ++d)
+    {
+      const IndexValueType shift = tiles[i][d] - tiles[i - 1][d];
+      if ((d == dim && std::abs(shift) != 1) || (d != dim && shift != 0))
+        return false;
+    }
+    return true;
+  };
+  unsigned int fastDim = 0;
+  unsigned int bestNbOfMoves = 0;
+  for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+  {
+    unsigned int nbOfMoves = 0;
+    for (unsigned int i = 1; i < n; ++i)
+      nbOfMoves += isMove(i, dim);
+    if (nbOfMoves > bestNbOfMoves)
+    {
+      fastDim = dim;
+      bestNbOfMoves = nbOfMoves;
+    }
+  }
+  if (bestNbOfMoves == 0)
+  {
+    // Strips and single tiles: walk along the dimension which has several tiles
+    for (int dim = ImageDimension - 1; dim >= 0; --dim)
+      if (axes[dim].count > 1)
+        fastDim = dim;
+  }
+  IndexValueType direction = 1;
+  for (unsigned int i = n - 1; i > 0; --i)
+    if (isMove(i, fastDim))
+    {
+      direction = tiles[i][fastDim] - tiles[i - 1][fastDim];
+      break;
+    }
+  const bool lastIsMove = (n > 1 && isMove(n - 1, fastDim));
+
+  bool serpentine = false;
+  unsigned int slowDim = (fastDim + 1) % ImageDimension;
+  IndexValueType slowDirection = 1;
+  bool hasRowChange = false;
+  for (unsigned int i = n - 1; i > 0 && !hasRowChange; --i)
+    for (unsigned int dim = 0; dim < ImageDimension; ++dim)
+      if (dim != fastDim && tiles[i][dim] != tiles[i - 1][dim])
+      {
+        slowDim = dim;
+        slowDirection = tiles[i][dim] > tiles[i - 1][dim] ? 1 : -1;
+        serpentine = (tiles[i][fastDim] == tiles[i - 1][fastDim]);
+        hasRowChange = true;
+      }
+
+  // When the last region started a new row, the direction is the one
+  // of the previous row (reversed for serpentine walks)
+  if (n > 1 && !lastIsMove && serpentine)
+    direction = -direction;
+
+  // Next tile of the row, or first tile of the next row
+  IndexType next(last);
+  next[fastDim] += direction;
+  if (next[fastDim] < 0 || next[fastDim] >= axes[fastDim].count)
+  {
+    next[slowDim] += slowDirection;
+    if (next[slowDim] < 0 || next[slowDim] >= axes[slowDim].count || slowDim == fastDim)
+      return false;
+    next[fastDim] = serpentine ? last[fastDim] : (direction > 0 ? 0 : axes[fastDim].count - 1);
+  }
+
+  nextRegion = GetTileRegion(axes, next);
+  otbDebugMacro(<< "Next tile " << next << ": start " << nextRegion.GetIndex() << " size " << nextRegion.GetSize());
+  return nextRegion.GetNumberOfPixels() > 0;
+}
+
+
+/**
+ * Constructor.
+ */
+template <class TRegion>
+PlanRegionPredictor<TRegion>::PlanRegionPredictor()
+{
+  m_Radius.Fill(0);
+  m_Position = 0;
+  m_PlanHitPixels = 0;
+  m_OffPlanWarned = false;
+}
+
+
+/**
+ * Set the planned regions. The position in the plan is unknown until a
+ * planned region is requested.
+ */
+template <class TRegion>
+void
+PlanRegionPredictor<TRegion>::SetPlan(const RegionList & plan)
+{
+  m_Plan = plan;
+  m_Position = m_Plan.size();
+  m_OffPlanWarned = false;
+  this->Modified();
+}
+
+
+/**
+ * Region requested to the filter for a planned region: padded by the radius
+ * and cropped to the largest possible region, like the downstream filters do.
+ */
+template <class TRegion>
+typename PlanRegionPredictor<TRegion>::RegionType
+PlanRegionPredictor<TRegion>::GetRequestedRegion(size_t position) const
+{
+  RegionType region(m_Plan[position]);
+  region.PadByRadius(m_Radius);
+  if (!region.Crop(this->GetLargestPossibleRegion()))
+    region.GetModifiableSize().Fill(0);
+  return region;
+}
+
+
+/**
+ * Position of a requested region in the plan. When the regions follow the
+ * plan, the region is found at the given position right away.
+ */
+template <class TRegion>
+size_t
+PlanRegionPredictor<TRegion>::Find(const RegionType & region, size_t from) const
+{
+  const size_t n = m_Plan.size();
+  for (size_t i = 0; i < n; ++i)
+  {
+    const size_t position = (from + i) % n;
+    if (GetRequestedRegion(position) == region)
+      return position;
+  }
+  return n;
+}
+
+
+/**
+ * Locate the requested region in the plan, and let the fallback predictor
+ * observe it.
+ */
+template <class TRegion>
+void
+PlanRegionPredictor<TRegion>::Observe(const RegionType & region)
+{
+  if (m_Fallback)
+  {
+    m_Fallback->SetLargestPossibleRegion(this->GetLargestPossibleRegion());
+    m_Fallback->Observe(region);
+  }
+
+  const bool wasOnPlan = IsOnPlan();
+  m_Position = Find(region, wasOnPlan ? m_Position + 1 : 0);
+  if (IsOnPlan())
+  {
+    m_PlanHitPixels += region.GetNumberOfPixels();
+  }
+  else if (!m_Plan.empty() && !m_OffPlanWarned)
+  {
+    otbWarningMacro(<< "Requested region start " << region.GetIndex() << " size " << region.GetSize() 
+      << " is not in the streaming plan, the next regions are guessed by the fallback predictor");
+    m_OffPlanWarned = true;
+  }
+  else if (wasOnPlan)
+  {
+    otbDebugMacro(<< "Requested region start " << region.GetIndex() << " size " << region.GetSize() 
+      << " is not in the plan, using the fallback predictor");
+  }
+
+  Superclass::Observe(region);
+}
+
+
+/**
+ * Next planned regions, or the guesses of the fallback predictor when the
+ * requested regions do not follow the plan.
+ */
+template <class TRegion>
+typename PlanRegionPredictor<TRegion>::RegionList
+PlanRegionPredictor<TRegion>::Predict(unsigned int count) const
+{
+  if (!IsOnPlan())
+    return m_Fallback ? m_Fallback->Predict(count) : RegionList();
+
+  RegionList predictedRegions;
+  for (size_t position = m_Position + 1; position < m_Plan.size() && predictedRegions.size() < count; ++position)
+  {
+    const RegionType region = GetRequestedRegion(position);
+    if (region.GetNumberOfPixels() > 0)
+      predictedRegions.push_back(region);
+  }
+  return predictedRegions;
+}
+
+
+/**
+ * Region following the last observed one.
+ */
+template <class TRegion>
+bool
+PlanRegionPredictor<TRegion>::PredictNext(const RegionHistory & itkNotUsed(history), RegionType & nextRegion) const
+{
+  const RegionList predictedRegions = Predict(1);
+  if (predictedRegions.empty())
+    return false;
+  nextRegion = predictedRegions.front();
+  return true;
+}
+
+
+/**
+ * Clear the history, the statistics and the position in the plan.
+ */
+template <class TRegion>
+void
+PlanRegionPredictor<TRegion>::Reset()
+{
+  Superclass::Reset();
+  m_Position = m_Plan.size();
+  m_PlanHitPixels = 0;
+  m_OffPlanWarned = false;
+  if (m_Fallback)
+    m_Fallback->Reset();
+}
+
+
+} // end namespace otb
+
+
+#endif
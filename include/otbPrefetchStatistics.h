@@ -0,0 +1,204 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchStatistics_h
+#define otbPrefetchStatistics_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+// OTB log
+#include "otbMacro.h"
+#include "itkMacro.h"
+
+#include <array>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+
+namespace otb
+{
+
+/**
+ * \class PrefetchStatistics
+ * \brief Performance telemetry of the prefetch filter.
+ *
+ * The statistics hold exact 64-bit counters (pixels, bytes, jobs, and times
+ * in nanoseconds), which can be updated concurrently from the caller and the
+ * worker threads. They also keep one record per requested region (wait and
+ * copy times, hit and missed pixels, predictor decision) and one record per
+ * fetch job of the workers (queue and fetch times, fetched bytes).
+ *
+ * The records can be exported as a Chrome trace (JSON file that can be
+ * opened in chrome://tracing or https://ui.perfetto.dev), with the counters
+ * in the "otherData" section.
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TRegion>
+class ITK_EXPORT PrefetchStatistics : public itk::Object
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef PrefetchStatistics            Self;
+  typedef itk::Object                   Superclass;
+  typedef itk::SmartPointer<Self>       Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PrefetchStatistics, itk::Object);
+
+  /** Regions typedefs */
+  typedef TRegion                          RegionType;
+  typedef typename std::vector<RegionType> RegionList;
+
+  /** Clock typedefs */
+  typedef std::chrono::steady_clock ClockType;
+  typedef ClockType::time_point     TimePointType;
+
+  /** Counters */
+  enum class Counter
+  {
+    Requests,        // regions requested to the filter
+    ProcessedPixels, // pixels requested to the filter
+    HitPixels,       // requested pixels that were cached or being fetched
+    MissedPixels,    // requested pixels that had to be fetched on request
+    ExtraPixels,     // fetched pixels that were never used
+    GraftedRequests, // outputs served by grafting a cached block
+    DiskPixels,      // requested or prefetched pixels read from the disk cache
+    FetchJobs,       // jobs fetched by the workers
+    CancelledJobs,   // jobs cancelled before being fetched
+    FetchedPixels,   // pixels requested to the upstream pipeline
+    FetchedBytes,    // bytes requested to the upstream pipeline
+    FetchNanoseconds,
+    WaitNanoseconds,
+    CopyNanoseconds,  // filling the outputs, in the caller thread
+    StageNanoseconds, // copying the fetched pixels to the cache blocks, in the workers
+    NumberOfCounters
+  };
+
+  /* Record of a region requested to the filter (times in seconds) */
+  struct RequestRecord {
+    RegionType region;
+    double start;          // since the creation of the statistics
+    double duration;       // time spent in GenerateData()
+    double wait;           // time spent waiting for the worker
+    double copy;           // time spent filling the output
+    uint64_t hitPixels;    // summed over the inputs
+    uint64_t missedPixels;
+    uint64_t fetchedPixels; // pixels fetched on request
+    uint64_t diskPixels;   // pixels read from the disk cache on request
+    bool grafted;          // all the outputs were grafted
+    unsigned int depth;    // number of regions prefetched ahead
+    std::string predictor;
+    RegionList predictedRegions;
+  };
+
+  /* Record of a fetch job of a worker (times in seconds) */
+  struct FetchRecord {
+    RegionType region;
+    unsigned int worker;   // one worker per input
+    bool urgent;
+    bool discarded;        // cancelled while being fetched
+    double submit;         // since the creation of the statistics
+    double start;
+    double duration;
+    uint64_t bytes;
+  };
+
+  /** Update a counter (thread safe) */
+  void Add(Counter counter, uint64_t value)
+  {
+    m_Counters[static_cast<unsigned int>(counter)] += value;
+  }
+
+  void Set(Counter counter, uint64_t value)
+  {
+    m_Counters[static_cast<unsigned int>(counter)] = value;
+  }
+
+  void AddSeconds(Counter counter, double seconds)
+  {
+    Add(counter, static_cast<uint64_t>(seconds * 1e9 + 0.5));
+  }
+
+  /** Read a counter (thread safe) */
+  uint64_t Get(Counter counter) const
+  {
+    return m_Counters[static_cast<unsigned int>(counter)];
+  }
+
+  double GetSeconds(Counter counter) const
+  {
+    return 1e-9 * Get(counter);
+  }
+
+  /** Name of a counter, used in the reports */
+  static const char * GetCounterName(Counter counter);
+
+  /** Seconds elapsed between the creation of the statistics and a time point */
+  double GetSeconds(const TimePointType & time) const
+  {
+    return std::chrono::duration<double>(time - m_Origin).count();
+  }
+
+  /** Maximum number of records of each kind. Further records are dropped,
+   * the counters are still updated. */
+  itkSetMacro(MaxNumberOfRecords, unsigned int);
+  itkGetMacro(MaxNumberOfRecords, unsigned int);
+
+  /** Add a record (thread safe) */
+  void AddRequestRecord(const RequestRecord & record);
+  void AddFetchRecord(const FetchRecord & record);
+
+  /** Copy of the records (thread safe) */
+  std::vector<RequestRecord> GetRequestRecords();
+  std::vector<FetchRecord> GetFetchRecords();
+
+  /** Write the records and the counters as a Chrome trace JSON file */
+  void WriteTrace(const std::string & filename);
+
+protected:
+  PrefetchStatistics();
+  ~PrefetchStatistics() {}
+
+  void PrintSelf(std::ostream & os, itk::Indent indent) const override;
+
+  /** JSON array of the index and size of a region */
+  static void WriteRegion(std::ostream & os, const RegionType & region);
+
+private:
+  PrefetchStatistics(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+  std::array<std::atomic<uint64_t>, static_cast<unsigned int>(Counter::NumberOfCounters)> m_Counters;
+  TimePointType m_Origin;
+  std::mutex m_Mutex;
+  std::vector<RequestRecord> m_RequestRecords;
+  std::vector<FetchRecord> m_FetchRecords;
+  unsigned int m_MaxNumberOfRecords;
+  uint64_t m_DroppedRecords;
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbPrefetchStatistics.hxx"
+
+#endif
@@ -0,0 +1,211 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchStatistics_txx
+#define otbPrefetchStatistics_txx
+
+#include "otbPrefetchStatistics.h"
+
+#include <fstream>
+#include <algorithm>
+
+namespace otb
+{
+
+/**
+ * Constructor.
+ */
+template <class TRegion>
+PrefetchStatistics<TRegion>::PrefetchStatistics()
+{
+  for (auto & counter : m_Counters)
+    counter = 0;
+  m_Origin = ClockType::now();
+  m_MaxNumberOfRecords = 1000000;
+  m_DroppedRecords = 0;
+}
+
+
+/**
+ * Name of a counter.
+ */
+template <class TRegion>
+const char *
+PrefetchStatistics<TRegion>::GetCounterName(Counter counter)
+{
+  switch (counter)
+  {
+    case Counter::Requests:         return "requests";
+    case Counter::ProcessedPixels:  return "processedPixels";
+    case Counter::HitPixels:        return "hitPixels";
+    case Counter::MissedPixels:     return "missedPixels";
+    case Counter::ExtraPixels:      return "extraPixels";
+    case Counter::GraftedRequests:  return "graftedRequests";
+    case Counter::DiskPixels:       return "diskPixels";
+    case Counter::FetchJobs:        return "fetchJobs";
+    case Counter::CancelledJobs:    return "cancelledJobs";
+    case Counter::FetchedPixels:    return "fetchedPixels";
+    case Counter::FetchedBytes:     return "fetchedBytes";
+    case Counter::FetchNanoseconds: return "fetchNanoseconds";
+    case Counter::WaitNanoseconds:  return "waitNanoseconds";
+    case Counter::CopyNanoseconds:  return "copyNanoseconds";
+    case Counter::StageNanoseconds: return "stageNanoseconds";
+    default:                        return "unknown";
+  }
+}
+
+
+/**
+ * Add the record of a requested region.
+ */
+template <class TRegion>
+void
+PrefetchStatistics<TRegion>::AddRequestRecord(const RequestRecord & record)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_RequestRecords.size() < m_MaxNumberOfRecords)
+    m_RequestRecords.push_back(record);
+  else
+    m_DroppedRecords++;
+}
+
+
+/**
+ * Add the record of a fetch job.
+ */
+template <class TRegion>
+void
+PrefetchStatistics<TRegion>::AddFetchRecord(const FetchRecord & record)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_FetchRecords.size() < m_MaxNumberOfRecords)
+    m_FetchRecords.push_back(record);
+  else
+    m_DroppedRecords++;
+}
+
+
+/**
+ * Copy of the records of the requested regions.
+ */
+template <class TRegion>
+std::vector<typename PrefetchStatistics<TRegion>::RequestRecord>
+PrefetchStatistics<TRegion>::GetRequestRecords()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_RequestRecords;
+}
+
+
+/**
+ * Copy of the records of the fetch jobs.
+ */
+template <class TRegion>
+std::vector<typename PrefetchStatistics<TRegion>::FetchRecord>
+PrefetchStatistics<TRegion>::GetFetchRecords()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_FetchRecords;
+}
+
+
+/**
+ * JSON array of the index and size of a region.
+ */
+template <class TRegion>
+void
+PrefetchStatistics<TRegion>::WriteRegion(std::ostream & os, const RegionType & region)
+{
+  os << "[";
+  for (unsigned int dim = 0; dim < RegionType::ImageDimension; ++dim)
+    os << region.GetIndex(dim) << ",";
+  for (unsigned int dim = 0; dim < RegionType::ImageDimension; ++dim)
+    os << region.GetSize(dim) << (dim + 1 < RegionType::ImageDimension ? "," : "");
+  os << "]";
+}
+
+
+/**
+ * Write a Chrome trace file.
+ * Requested regions are complete events of the thread 1, fetch jobs are
+ * complete events of the thread 2 + worker id (times in microseconds).
+ * Regions are written as [index, size] arrays.
+ */
+template <class TRegion>
+void
+PrefetchStatistics<TRegion>::WriteTrace(const std::string & filename)
+{
+  std::ofstream os(filename);
+  if (!os)
+    itkExceptionMacro(<< "Unable to write the trace file " << filename);
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  unsigned int nbOfWorkers = 1;
+  for (auto & record : m_FetchRecords)
+    nbOfWorkers = std::max(nbOfWorkers, record.worker + 1);
+  os << std::fixed;
+  os.precision(6);
+  os << "{\"traceEvents\":[\n";
+  os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"GenerateData\"}}";
+  for (unsigned int worker = 0; worker < nbOfWorkers; ++worker)
+    os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << 2 + worker 
+       << ",\"args\":{\"name\":\"Worker " << worker << "\"}}";
+  for (auto & record : m_RequestRecords)
+  {
+    os << ",\n{\"name\":\"Request\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+       << ",\"ts\":" << 1e6 * record.start << ",\"dur\":" << 1e6 * record.duration << ",\"args\":{\"region\":";
+    WriteRegion(os, record.region);
+    os << ",\"wait\":" << record.wait << ",\"copy\":" << record.copy
+       << ",\"hitPixels\":" << record.hitPixels << ",\"missedPixels\":" << record.missedPixels
+       << ",\"fetchedPixels\":" << record.fetchedPixels << ",\"diskPixels\":" << record.diskPixels << ",\"grafted\":" << (record.grafted ? "true" : "false")
+       << ",\"depth\":" << record.depth << ",\"predictor\":\"" << record.predictor << "\",\"predictedRegions\":[";
+    for (unsigned int i = 0; i < record.predictedRegions.size(); ++i)
+    {
+      os << (i > 0 ? "," : "");
+      WriteRegion(os, record.predictedRegions[i]);
+    }
+    os << "]}}";
+  }
+  for (auto & record : m_FetchRecords)
+  {
+    os << ",\n{\"name\":\"" << (record.urgent ? "Urgent fetch" : "Speculative fetch") << "\",\"cat\":\"fetch\",\"ph\":\"X\",\"pid\":1,\"tid\":" << 2 + record.worker
+       << ",\"ts\":" << 1e6 * record.start << ",\"dur\":" << 1e6 * record.duration << ",\"args\":{\"region\":";
+    WriteRegion(os, record.region);
+    os << ",\"queued\":" << record.start - record.submit << ",\"bytes\":" << record.bytes
+       << ",\"discarded\":" << (record.discarded ? "true" : "false") << "}}";
+  }
+  os << "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{";
+  for (unsigned int i = 0; i < m_Counters.size(); ++i)
+    os << "\"" << GetCounterName(static_cast<Counter>(i)) << "\":" << m_Counters[i] << ",";
+  os << "\"droppedRecords\":" << m_DroppedRecords << "}}\n";
+
+  if (!os)
+    itkExceptionMacro(<< "Unable to write the trace file " << filename);
+  otbDebugMacro(<< "Trace written in " << filename);
+}
+
+
+/**
+ * Print the counters.
+ */
+template <class TRegion>
+void
+PrefetchStatistics<TRegion>::PrintSelf(std::ostream & os, itk::Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  for (unsigned int i = 0; i < m_Counters.size(); ++i)
+    os << indent << GetCounterName(static_cast<Counter>(i)) << ": " << m_Counters[i] << std::endl;
+}
+
+
+} // end namespace otb
+
+
+#endif
@@ -0,0 +1,226 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchWorker_h
+#define otbPrefetchWorker_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+// OTB log
+#include "otbMacro.h"
+#include "itkMacro.h"
+
+// Telemetry
+#include "otbPrefetchStatistics.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <chrono>
+
+namespace otb
+{
+
+/**
+ * \class PrefetchWorker
+ * \brief Long-lived thread that pulls regions from an upstream image.
+ *
+ * The worker owns a single thread, started once and kept alive until the
+ * worker is stopped. It is fed with fetch jobs through a queue: each job
+ * holds a region to request to the upstream pipeline, and a sink that is
+ * called (from the worker thread) once the upstream pipeline has produced
+ * the region. Jobs can be submitted as speculative (appended to the queue)
+ * or urgent (put in front of the queue), promoted, and cancelled. Cancelling
+ * a job that is already being fetched can only discard its result, since the
+ * upstream pipeline update cannot be interrupted.
+ *
+ * Only the worker thread triggers the upstream pipeline: this keeps the
+ * upstream filters away from concurrent updates. Workers whose inputs share
+ * upstream filters also share an upstream mutex, so that they update them in
+ * turn.
+ *
+ * A sink can defer some work (e.g. writing the pixels to a disk cache) until
+ * the job is done, so that the callers waiting for the job do not wait for it.
+ *
+ * The worker also measures the time spent by the upstream pipeline to
+ * produce one pixel, which is used by the caller to adapt the number of
+ * regions that are prefetched ahead. When statistics are set, each fetch job
+ * is recorded with its queue and fetch times.
+ *
+ * \ingroup OTBPrefetch
+ */
+template <class TImage>
+class ITK_EXPORT PrefetchWorker : public itk::Object
+{
+
+public:
+  /** Standard class typedefs. */
+  typedef PrefetchWorker                Self;
+  typedef itk::Object                   Superclass;
+  typedef itk::SmartPointer<Self>       Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PrefetchWorker, itk::Object);
+
+  /** Images typedefs */
+  typedef TImage                       ImageType;
+  typedef typename ImageType::RegionType RegionType;
+
+  /** Statistics typedefs */
+  typedef PrefetchStatistics<RegionType> StatisticsType;
+  typedef typename StatisticsType::TimePointType TimePointType;
+
+  /** Called from the worker thread, with the upstream image holding the fetched region */
+  typedef std::function<void(const ImageType *, const RegionType &)> SinkType;
+
+  /** Task deferred by a sink */
+  typedef std::function<void()> TaskType;
+
+  /** Life cycle of a fetch job */
+  enum class JobState
+  {
+    Queued,
+    Fetching,
+    Done,
+    Cancelled
+  };
+
+  /* Fetch job */
+  struct Job {
+    Job(const RegionType & rgn, const SinkType & snk, bool urg): 
+      region(rgn), sink(snk), state(JobState::Queued), urgent(urg), submitTime(StatisticsType::ClockType::now()), fetchSecs(0) {};
+    RegionType region;
+    SinkType sink;
+    JobState state;
+    bool urgent;
+    TimePointType submitTime;
+    double fetchSecs;
+    std::exception_ptr error;
+  };
+  typedef std::shared_ptr<Job> JobPointer;
+
+  void SetInput(ImageType * input)
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_InputImage = input;
+  }
+
+  typename ImageType::Pointer GetInput()
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_InputImage;
+  }
+
+  /** Mutex held while the upstream pipeline is updated. By default, each
+   * worker has its own. */
+  void SetUpstreamMutex(const std::shared_ptr<std::mutex> & mutex)
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_UpstreamMutex = mutex;
+  }
+
+  std::shared_ptr<std::mutex> GetUpstreamMutex()
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_UpstreamMutex;
+  }
+
+  /** Identifier of the worker in the fetch records */
+  itkSetMacro(Id, unsigned int);
+  itkGetMacro(Id, unsigned int);
+
+  /** Statistics updated with the fetch jobs (optional) */
+  itkSetObjectMacro(Statistics, StatisticsType);
+  itkGetObjectMacro(Statistics, StatisticsType);
+
+  /** Start the thread (does nothing when it is already running) */
+  void Start();
+
+  /** Cancel all queued jobs, then wait for the thread to join */
+  void Stop();
+
+  /** Queue a new job. Urgent jobs are put in front of the queue */
+  JobPointer Submit(const RegionType & region, const SinkType & sink, bool urgent = false);
+
+  /** Move a queued job in front of the queue */
+  void Promote(const JobPointer & job);
+
+  /** Cancel a job. A job being fetched is discarded only if discardIfFetching
+   * is true. Returns true if the job will not complete. */
+  bool Cancel(const JobPointer & job, bool discardIfFetching = true);
+
+  /** Block until the job is done. Rethrows the upstream error if any. */
+  void Wait(const JobPointer & job);
+
+  /** True if the job is done and the upstream pipeline failed */
+  bool HasFailed(const JobPointer & job);
+
+  /** True if the job is queued or being fetched */
+  bool IsPending(const JobPointer & job);
+
+  /** Run a task in the worker thread once the current job is done, after the
+   * callers waiting for it are released. Only called from a sink. The task
+   * is not part of the fetch time. */
+  void Defer(const TaskType & task);
+
+  /** Number of jobs queued or being fetched */
+  unsigned int GetNumberOfPendingJobs();
+
+  /** Mean time (and mean absolute deviation) to fetch one pixel, in seconds */
+  double GetSecondsPerPixel();
+  double GetSecondsPerPixelDeviation();
+
+protected:
+  PrefetchWorker();
+  ~PrefetchWorker();
+
+  /** Thread loop */
+  void Run();
+
+  /** Trigger the upstream pipeline for a job */
+  void Fetch(const JobPointer & job);
+
+private:
+  PrefetchWorker(const Self &); // purposely not implemented
+  void operator=(const Self &); // purposely not implemented
+
+  typename ImageType::Pointer m_InputImage;
+  std::shared_ptr<std::mutex> m_UpstreamMutex;
+  unsigned int m_Id;
+  typename StatisticsType::Pointer m_Statistics;
+  std::thread m_Thread;
+  std::mutex m_Mutex;
+  std::condition_variable m_Condition;
+  std::deque<JobPointer> m_Queue;
+  JobPointer m_CurrentJob;
+  std::vector<TaskType> m_DeferredTasks;
+  bool m_StopRequested;
+  bool m_HasMeasurements;
+  double m_SecondsPerPixel;
+  double m_SecondsPerPixelDeviation;
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbPrefetchWorker.hxx"
+
+#endif
@@ -0,0 +1,388 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbPrefetchWorker_txx
+#define otbPrefetchWorker_txx
+
+#include "otbPrefetchWorker.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace otb
+{
+
+/**
+ * Constructor.
+ */
+template <class TImage>
+PrefetchWorker<TImage>::PrefetchWorker()
+{
+  m_InputImage = nullptr;
+  m_UpstreamMutex = std::make_shared<std::mutex>();
+  m_Id = 0;
+  m_StopRequested = false;
+  m_HasMeasurements = false;
+  m_SecondsPerPixel = 0;
+  m_SecondsPerPixelDeviation = 0;
+}
+
+
+/**
+ * Destructor.
+ */
+template <class TImage>
+PrefetchWorker<TImage>::~PrefetchWorker()
+{
+  Stop();
+}
+
+
+/**
+ * Start the thread.
+ */
+template <class TImage>
+void
+PrefetchWorker<TImage>::Start()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_Thread.joinable())
+    return;
+  m_StopRequested = false;
+  m_Thread = std::thread(&PrefetchWorker<TImage>::Run, this);
+}
+
+
+/**
+ * Stop the thread.
+ * Queued jobs are cancelled, the job being fetched is completed.
+ */
+template <class TImage>
+void
+PrefetchWorker<TImage>::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_StopRequested = true;
+    for (auto & job : m_Queue)
+    {
+      job->state = JobState::Cancelled;
+      job->sink = nullptr;
+    }
+    m_Queue.clear();
+  }
+  m_Condition.notify_all();
+
+  if (m_Thread.joinable())
+    m_Thread.join();
+}
+
+
+/**
+ * Queue a new job.
+ */
+template <class TImage>
+typename PrefetchWorker<TImage>::JobPointer
+PrefetchWorker<TImage>::Submit(const RegionType & region, const SinkType & sink, bool urgent)
+{
+  otbDebugMacro(<< "Submit " << (urgent ? "urgent" : "speculative") << " job for region start " << region.GetIndex() << " size " << region.GetSize());
+  auto job = std::make_shared<Job>(region, sink, urgent);
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (urgent)
+      m_Queue.push_front(job);
+    else
+      m_Queue.push_back(job);
+  }
+  m_Condition.notify_all();
+  return job;
+}
+
+
+/**
+ * Move a queued job in front of the queue.
+ */
+template <class TImage>
+void
+PrefetchWorker<TImage>::Promote(const JobPointer & job)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = std::find(m_Queue.begin(), m_Queue.end(), job);
+  if (it != m_Queue.end() && it != m_Queue.begin())
+  {
+    m_Queue.erase(it);
+    m_Queue.push_front(job);
+  }
+}
+
+
+/**
+ * Cancel a job.
+ * A queued job is removed from the queue. A job that is being fetched
+ * cannot be interrupted, but its result can be discarded.
+ */
+template <class TImage>
+bool
+PrefetchWorker<TImage>::Cancel(const JobPointer & job, bool discardIfFetching)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (job->state == JobState::Done || job->state == JobState::Cancelled)
+    return job->state == JobState::Cancelled;
+  if (job->state == JobState::Fetching && !discardIfFetching)
+    return false;
+
+  if (job->state == JobState::Queued)
+  {
+    auto it = std::find(m_Queue.begin(), m_Queue.end(), job);
+    if (it != m_Queue.end())
+      m_Queue.erase(it);
+    job->sink = nullptr;
+    if (m_Statistics)
+      m_Statistics->Add(StatisticsType::Counter::CancelledJobs, 1);
+  }
+  // When the job is being fetched, the sink is released by the worker
+  job->state = JobState::Cancelled;
+  otbDebugMacro(<< "Cancelled job for region start " << job->region.GetIndex() << " size " << job->region.GetSize());
+  return true;
+}
+
+
+/**
+ * Block until the job is done.
+ */
+template <class TImage>
+void
+PrefetchWorker<TImage>::Wait(const JobPointer & job)
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  m_Condition.wait(lock, [&job, this] { return job->state == JobState::Done || job->state == JobState::Cancelled || m_StopRequested; });
+  if (job->state != JobState::Done)
+    itkExceptionMacro(<< "Fetch job for region start " << job->region.GetIndex() << " size " << job->region.GetSize() << " has been cancelled");
+  if (job->error)
+    std::rethrow_exception(job->error);
+}
+
+
+/**
+ * True if the job is done and the upstream pipeline failed.
+ */
+template <class TImage>
+bool
+PrefetchWorker<TImage>::HasFailed(const JobPointer & job)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return job->state == JobState::Done && job->error;
+}
+
+
+/**
+ * True if the job is queued or being fetched.
+ */
+template <class TImage>
+bool
+PrefetchWorker<TImage>::IsPending(const JobPointer & job)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return job->state == JobState::Queued || job->state == JobState::Fetching;
+}
+
+
+/**
+ * Run a task once the current job is done.
+ */
+template <class TImage>
+void
+PrefetchWorker<TImage>::Defer(const TaskType & task)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_DeferredTasks.push_back(task);
+}
+
+
+/**
+ * Number of jobs queued or being fetched.
+ */
+template <class TImage>
+unsigned int
+PrefetchWorker<TImage>::GetNumberOfPendingJobs()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Queue.size() + (m_CurrentJob ? 1 : 0);
+}
+
+
+/**
+ * Mean time to fetch one pixel.
+ */
+template <class TImage>
+double
+PrefetchWorker<TImage>::GetSecondsPerPixel()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_SecondsPerPixel;
+}
+
+
+/**
+ * Mean absolute deviation of the time to fetch one pixel.
+ */
+template <class TImage>
+double
+PrefetchWorker<TImage>::GetSecondsPerPixelDeviation()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_SecondsPerPixelDeviation;
+}
+
+
+/**
+ * Thread loop: pop the jobs and fetch them, until stop is requested.
+ */
+template <class TImage>
+void
+PrefetchWorker<TImage>::Run()
+{
+  while (true)
+  {
+    JobPointer job;
+    {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      m_Condition.wait(lock, [this] { return m_StopRequested || !m_Queue.empty(); });
+      if (m_StopRequested)
+        break;
+      job = m_Queue.front();
+      m_Queue.pop_front();
+      job->state = JobState::Fetching;
+      m_CurrentJob = job;
+    }
+
+    Fetch(job);
+
+    std::vector<TaskType> tasks;
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      if (job->state == JobState::Fetching)
+        job->state = JobState::Done;
+      job->sink = nullptr;
+      m_CurrentJob = nullptr;
+      tasks.swap(m_DeferredTasks);
+    }
+    m_Condition.notify_all();
+
+    // Deferred tasks, once the waiting callers are released
+    for (auto & task : tasks)
+    {
+      try
+      {
+        task();
+      }
+      catch (const std::exception & err)
+      {
+        otbWarningMacro(<< "Deferred task of the fetch job for region start " << job->region.GetIndex() << " failed: " << err.what());
+      }
+    }
+  }
+}
+
+
+/**
+ * Trigger the upstream pipeline, then hand the result to the job sink.
+ */
+template <class TImage>
+void
+PrefetchWorker<TImage>::Fetch(const JobPointer & job)
+{
+  otbDebugMacro(<< "Fetching region start " << job->region.GetIndex() << " size " << job->region.GetSize());
+
+  // The workers sharing upstream filters update them in turn. The wait is not
+  // part of the fetch time.
+  std::shared_ptr<std::mutex> upstreamMutex = GetUpstreamMutex();
+  std::lock_guard<std::mutex> upstreamLock(*upstreamMutex);
+  auto start{std::chrono::steady_clock::now()};
+  uint64_t bytes = 0;
+  try
+  {
+    typename ImageType::Pointer inputImage = GetInput();
+    inputImage->SetRequestedRegion(job->region);
+    inputImage->PropagateRequestedRegion();
+    inputImage->UpdateOutputData();
+
+    // e.g. the upstream filter has been released meanwhile
+    if (!inputImage->GetBufferedRegion().IsInside(job->region))
+      itkExceptionMacro(<< "The upstream pipeline did not produce the region start " << job->region.GetIndex()
+        << " size " << job->region.GetSize());
+    bytes = static_cast<uint64_t>(job->region.GetNumberOfPixels()) * inputImage->GetNumberOfComponentsPerPixel() * 
+      sizeof(typename ImageType::InternalPixelType);
+
+    // The result of a job cancelled meanwhile is not needed anymore
+    SinkType sink;
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      if (job->state == JobState::Fetching)
+        sink = job->sink;
+    }
+    if (sink)
+      sink(inputImage, job->region);
+  }
+  catch (...)
+  {
+    job->error = std::current_exception();
+  }
+  auto end{std::chrono::steady_clock::now()};
+  const std::chrono::duration<double> elapsed_seconds{end - start};
+  job->fetchSecs = elapsed_seconds.count();
+  otbDebugMacro(<< "Fetching region start " << job->region.GetIndex() << " size " << job->region.GetSize() << "...done (" << job->fetchSecs << "s)");
+
+  if (m_Statistics)
+  {
+    typename StatisticsType::FetchRecord record;
+    record.region = job->region;
+    record.worker = m_Id;
+    record.urgent = job->urgent;
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      record.discarded = (job->state == JobState::Cancelled);
+    }
+    record.submit = m_Statistics->GetSeconds(job->submitTime);
+    record.start = m_Statistics->GetSeconds(start);
+    record.duration = job->fetchSecs;
+    record.bytes = bytes;
+    m_Statistics->AddFetchRecord(record);
+    m_Statistics->Add(StatisticsType::Counter::FetchJobs, 1);
+    m_Statistics->Add(StatisticsType::Counter::FetchedPixels, job->region.GetNumberOfPixels());
+    m_Statistics->Add(StatisticsType::Counter::FetchedBytes, bytes);
+    m_Statistics->AddSeconds(StatisticsType::Counter::FetchNanoseconds, job->fetchSecs);
+  }
+
+  // Exponential moving average of the fetch time per pixel
+  const auto nbOfPixels = job->region.GetNumberOfPixels();
+  if (nbOfPixels > 0 && !job->error)
+  {
+    const double alpha = 0.2;
+    const double secsPerPixel = job->fetchSecs / nbOfPixels;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_HasMeasurements)
+    {
+      m_SecondsPerPixel = secsPerPixel;
+      m_HasMeasurements = true;
+    }
+    else
+    {
+      m_SecondsPerPixelDeviation += alpha * (std::abs(secsPerPixel - m_SecondsPerPixel) - m_SecondsPerPixelDeviation);
+      m_SecondsPerPixel += alpha * (secsPerPixel - m_SecondsPerPixel);
+    }
+  }
+}
+
+
+} // end namespace otb
+
+
+#endif
@@ -1,11 +1,18 @@
 set(DOCUMENTATION "This module provide a filter and an application to prefetch the input in an asynchronous fashion.")
 
 otb_module(OTBPrefetch
+  ENABLE_SHARED
   DEPENDS
     OTBCommon
+    OTBImageBase
+    OTBImageIO
+    OTBImageManipulation
+    OTBObjectList
+    OTBStreaming
     OTBApplicationEngine
 
   TEST_DEPENDS
+    OTBTestKernel
 
   DESCRIPTION
     "${DOCUMENTATION}"
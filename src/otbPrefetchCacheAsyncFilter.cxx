@@ -0,0 +1,32 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbPrefetchCacheAsyncFilter.h"
+
+namespace otb
+{
+
+// Native pixel types of the Prefetch application, scalar and vector images
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<uint8_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<int16_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<uint16_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<int32_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<uint32_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<float>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<Image<double>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<uint8_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<int16_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<uint16_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<int32_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<uint32_t>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<float>>;
+template class OTBPrefetch_EXPORT PrefetchCacheAsyncFilter<VectorImage<double>>;
+
+} // end namespace otb
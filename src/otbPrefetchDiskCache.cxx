@@ -0,0 +1,332 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbPrefetchDiskCache.h"
+
+#include <vector>
+#include <tuple>
+#include <thread>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace otb
+{
+
+namespace
+{
+// Header of a block file: magic, then number of bytes of pixels. The pixels
+// start at a 64 bytes offset, which keeps them aligned for any pixel type.
+const char   BlockMagic[8] = {'O', 'T', 'B', 'P', 'F', 'B', '0', '1'};
+const size_t BlockHeaderSize = 64;
+const char * BlockExtension = ".blk";
+
+#ifndef _WIN32
+bool IsDirectory(const std::string & path)
+{
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+/** Create a directory and its parents */
+bool MakeDirectory(const std::string & path)
+{
+  if (path.empty() || IsDirectory(path))
+    return true;
+  const size_t sep = path.find_last_of('/');
+  if (sep != std::string::npos && sep > 0 && !MakeDirectory(path.substr(0, sep)))
+    return false;
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+/* Block file found in the cache directory */
+struct BlockFile {
+  std::string path;
+  uint64_t bytes;
+  time_t mtime;
+};
+
+/** Block files of the cache directory (one level of key directories) */
+std::vector<BlockFile> ListBlockFiles(const std::string & directory)
+{
+  std::vector<BlockFile> files;
+  DIR * dir = opendir(directory.c_str());
+  if (dir == nullptr)
+    return files;
+  while (struct dirent * keyEntry = readdir(dir))
+  {
+    if (keyEntry->d_name[0] == '.')
+      continue;
+    const std::string keyPath = directory + "/" + keyEntry->d_name;
+    DIR * keyDir = opendir(keyPath.c_str());
+    if (keyDir == nullptr)
+      continue;
+    while (struct dirent * blockEntry = readdir(keyDir))
+    {
+      const std::string name(blockEntry->d_name);
+      if (name.size() <= std::strlen(BlockExtension) ||
+          name.compare(name.size() - std::strlen(BlockExtension), std::string::npos, BlockExtension) != 0)
+        continue;
+      BlockFile file;
+      file.path = keyPath + "/" + name;
+      struct stat info;
+      if (stat(file.path.c_str(), &info) != 0)
+        continue;
+      file.bytes = info.st_size;
+      file.mtime = info.st_mtime;
+      files.push_back(file);
+    }
+    closedir(keyDir);
+  }
+  closedir(dir);
+  return files;
+}
+#endif
+}
+
+
+/**
+ * Constructor.
+ */
+PrefetchDiskCache::PrefetchDiskCache()
+{
+  m_MaxBytes = 4096ull * 1024 * 1024;
+  m_Bytes = 0;
+}
+
+
+/**
+ * Unmap a block file.
+ */
+PrefetchDiskCache::Mapping::~Mapping()
+{
+#ifndef _WIN32
+  if (address != nullptr)
+    munmap(address, length);
+#endif
+}
+
+
+/**
+ * Create the directory, and account the existing block files.
+ */
+bool
+PrefetchDiskCache::Open(const std::string & directory)
+{
+#ifdef _WIN32
+  otbWarningMacro(<< "The disk cache is not supported on this system");
+  return false;
+#else
+  if (!MakeDirectory(directory))
+  {
+    otbWarningMacro(<< "Unable to create the disk cache directory " << directory << ": " << std::strerror(errno));
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Directory = directory;
+  Evict(m_MaxBytes);
+  otbDebugMacro(<< "Disk cache " << m_Directory << ": " << m_Bytes << " bytes");
+  return true;
+#endif
+}
+
+
+/**
+ * Current size of the block files.
+ */
+uint64_t
+PrefetchDiskCache::GetBytes()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Bytes;
+}
+
+
+/**
+ * 64-bit FNV-1a hash of a text.
+ */
+std::string
+PrefetchDiskCache::Hash(const std::string & text)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : text)
+  {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  std::ostringstream os;
+  os << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return os.str();
+}
+
+
+/**
+ * Path of a block file.
+ */
+std::string
+PrefetchDiskCache::GetBlockPath(const std::string & key, const std::string & block) const
+{
+  return m_Directory + "/" + key + "/" + block + BlockExtension;
+}
+
+
+/**
+ * Map a block file.
+ */
+PrefetchDiskCache::MappingPointer
+PrefetchDiskCache::Load(const std::string & key, const std::string & block, uint64_t bytes)
+{
+#ifdef _WIN32
+  return nullptr;
+#else
+  if (!IsOpen())
+    return nullptr;
+  const std::string path = GetBlockPath(key, block);
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  auto mapping = std::make_shared<Mapping>();
+  struct stat info;
+  if (fstat(fd, &info) == 0 && static_cast<uint64_t>(info.st_size) == BlockHeaderSize + bytes)
+  {
+    void * address = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (address != MAP_FAILED)
+    {
+      mapping->address = address;
+      mapping->length = info.st_size;
+    }
+  }
+  close(fd);
+  if (mapping->address == nullptr)
+    return nullptr;
+
+  // Check the header
+  const char * header = static_cast<const char *>(mapping->address);
+  uint64_t headerBytes = 0;
+  std::memcpy(&headerBytes, header + sizeof(BlockMagic), sizeof(headerBytes));
+  if (std::memcmp(header, BlockMagic, sizeof(BlockMagic)) != 0 || headerBytes != bytes)
+  {
+    otbWarningMacro(<< "Ignoring the invalid block file " << path);
+    return nullptr;
+  }
+  mapping->data = header + BlockHeaderSize;
+  mapping->bytes = bytes;
+
+  // Recently used blocks are evicted last
+  utimes(path.c_str(), nullptr);
+  return mapping;
+#endif
+}
+
+
+/**
+ * Write a block file.
+ * The pixels are written in a temporary file, which is then renamed: other
+ * processes never see partial block files.
+ */
+bool
+PrefetchDiskCache::Store(const std::string & key, const std::string & block, const void * data, uint64_t bytes)
+{
+#ifdef _WIN32
+  return false;
+#else
+  if (!IsOpen())
+    return false;
+  const std::string path = GetBlockPath(key, block);
+  if (access(path.c_str(), F_OK) == 0)
+    return true;
+  if (!MakeDirectory(m_Directory + "/" + key))
+    return false;
+
+  std::ostringstream tmpPath;
+  tmpPath << path << ".tmp" << getpid() << "_" << std::this_thread::get_id();
+  FILE * file = std::fopen(tmpPath.str().c_str(), "wb");
+  if (file == nullptr)
+    return false;
+  char header[BlockHeaderSize] = {};
+  std::memcpy(header, BlockMagic, sizeof(BlockMagic));
+  std::memcpy(header + sizeof(BlockMagic), &bytes, sizeof(bytes));
+  bool written = std::fwrite(header, 1, BlockHeaderSize, file) == BlockHeaderSize &&
+                 std::fwrite(data, 1, bytes, file) == bytes;
+  written = (std::fclose(file) == 0) && written;
+  if (!written || std::rename(tmpPath.str().c_str(), path.c_str()) != 0)
+  {
+    otbDebugMacro(<< "Unable to write the block file " << path);
+    std::remove(tmpPath.str().c_str());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Bytes += BlockHeaderSize + bytes;
+  if (m_Bytes > m_MaxBytes)
+    Evict(m_MaxBytes - m_MaxBytes / 10);
+  return true;
+#endif
+}
+
+
+/**
+ * Delete the least recently used block files.
+ * The block files are listed again, since other processes may share the
+ * directory.
+ */
+void
+PrefetchDiskCache::Evict(uint64_t maxBytes)
+{
+#ifndef _WIN32
+  std::vector<BlockFile> files = ListBlockFiles(m_Directory);
+  m_Bytes = 0;
+  for (auto & file : files)
+    m_Bytes += file.bytes;
+  if (m_Bytes <= maxBytes)
+    return;
+
+  std::sort(files.begin(), files.end(), [](const BlockFile & a, const BlockFile & b) { return a.mtime < b.mtime; });
+  for (auto & file : files)
+  {
+    if (m_Bytes <= maxBytes)
+      break;
+    if (unlink(file.path.c_str()) == 0 || errno == ENOENT)
+      m_Bytes -= file.bytes;
+  }
+  otbDebugMacro(<< "Disk cache evicted down to " << m_Bytes << " bytes");
+#endif
+}
+
+
+/**
+ * Print the state of the cache.
+ */
+void
+PrefetchDiskCache::PrintSelf(std::ostream & os, itk::Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Directory: " << m_Directory << std::endl;
+  os << indent << "MaxBytes: " << m_MaxBytes << std::endl;
+  os << indent << "Bytes: " << m_Bytes << std::endl;
+}
+
+
+} // end namespace otb
@@ -0,0 +1,171 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbVectorImage.h"
+#include "otbPrefetchBlockCache.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+namespace
+{
+
+typedef otb::VectorImage<float, 2>          ImageType;
+typedef ImageType::RegionType               RegionType;
+typedef ImageType::SizeType                 SizeType;
+typedef ImageType::IndexType                IndexType;
+typedef otb::PrefetchBlockCache<ImageType>  CacheType;
+
+IndexType MakeIndex(IndexType::IndexValueType x, IndexType::IndexValueType y)
+{
+  IndexType index;
+  index[0] = x;
+  index[1] = y;
+  return index;
+}
+
+/* Insert a ready block */
+CacheType::BlockPointer InsertReady(CacheType * cache, const IndexType & index)
+{
+  CacheType::BlockPointer block = cache->Insert(index);
+  cache->SetReady(block, cache->NewBuffer(block->region));
+  return block;
+}
+
+/* Check the blocks that are cached, and the ones that have been evicted
+ * (their pixels are released). Find() is not used, since it changes the
+ * order of the blocks. */
+bool CheckCached(const CacheType::BlockList & cached, const CacheType::BlockList & evicted)
+{
+  bool ok = true;
+  for (auto & block : cached)
+    if (!block->buffer)
+    {
+      std::cerr << "Block " << block->index << " has been evicted" << std::endl;
+      ok = false;
+    }
+  for (auto & block : evicted)
+    if (block->buffer)
+    {
+      std::cerr << "Block " << block->index << " has not been evicted" << std::endl;
+      ok = false;
+    }
+  return ok;
+}
+
+} // end namespace
+
+
+/**
+ * Check the grouping of blocks in rectangles, and the LRU eviction of the
+ * blocks, which keeps the pinned, pending and protected ones.
+ */
+int otbPrefetchBlockCacheTest(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // A grid of 8x8 blocks of 64x64 pixels, the last column and row are narrower
+  RegionType largestRegion;
+  largestRegion.SetIndex(0, 10);
+  largestRegion.SetIndex(1, -5);
+  largestRegion.SetSize(0, 500);
+  largestRegion.SetSize(1, 490);
+  SizeType blockSize;
+  blockSize.Fill(64);
+  CacheType::Pointer cache = CacheType::New();
+  cache->SetGeometry(largestRegion, blockSize, 2);
+
+  // Coalesce: a 3x2 rectangle, a run of 2 blocks, a single block, a run that
+  // only partially covers the row above it, and duplicates
+  std::vector<IndexType> indices = {MakeIndex(0, 0), MakeIndex(1, 0), MakeIndex(2, 0), MakeIndex(0, 1), MakeIndex(1, 1),
+                                    MakeIndex(2, 1), MakeIndex(5, 0), MakeIndex(6, 0), MakeIndex(5, 2), MakeIndex(6, 7),
+                                    MakeIndex(7, 7), MakeIndex(7, 6), MakeIndex(1, 0), MakeIndex(5, 2)};
+  const std::vector<CacheType::BlockIndexList> rectangles = cache->Coalesce(indices);
+  std::vector<IndexType> covered;
+  for (auto & rectangle : rectangles)
+  {
+    // The blocks of a rectangle tile its bounding region
+    const RegionType region = cache->GetBlocksRegion(rectangle);
+    itk::SizeValueType nbOfPixels = 0;
+    for (auto & index : rectangle)
+    {
+      nbOfPixels += cache->GetBlockRegion(index).GetNumberOfPixels();
+      if (std::find(covered.begin(), covered.end(), index) != covered.end())
+      {
+        std::cerr << "Block " << index << " is in several rectangles" << std::endl;
+        return EXIT_FAILURE;
+      }
+      covered.push_back(index);
+    }
+    if (nbOfPixels != region.GetNumberOfPixels())
+    {
+      std::cerr << "The blocks of rectangle " << region << " do not tile it" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (covered.size() != 12 || rectangles.size() != 5)
+  {
+    std::cerr << "Expected 12 blocks in 5 rectangles, got " << covered.size() << " blocks in " << rectangles.size()
+              << " rectangles" << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (auto & index : indices)
+    if (std::find(covered.begin(), covered.end(), index) == covered.end())
+    {
+      std::cerr << "Block " << index << " is not in a rectangle" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  // LRU eviction, with a budget of 4 full blocks
+  const uint64_t blockBytes = cache->GetRegionBytes(cache->GetBlockRegion(MakeIndex(0, 0)));
+  cache->SetMaxBytes(4 * blockBytes);
+  CacheType::BlockPointer a = InsertReady(cache, MakeIndex(0, 0));
+  CacheType::BlockPointer b = InsertReady(cache, MakeIndex(1, 0));
+  CacheType::BlockPointer c = InsertReady(cache, MakeIndex(2, 0));
+  CacheType::BlockPointer d = InsertReady(cache, MakeIndex(3, 0));
+
+  // The least recently used block is pinned, b is used again: c is evicted
+  cache->Pin(a);
+  cache->Find(b->index);
+  if (!cache->MakeRoom(blockBytes, cache->GetStamp()) || !CheckCached({a, b, d}, {c}))
+    return EXIT_FAILURE;
+
+  // A pending block is not evicted either: d then b are evicted, then there
+  // is no more room
+  CacheType::BlockPointer e = cache->Insert(MakeIndex(4, 0));
+  if (!cache->MakeRoom(blockBytes, cache->GetStamp()) || !CheckCached({a, b}, {d}))
+    return EXIT_FAILURE;
+  if (cache->MakeRoom(3 * blockBytes, cache->GetStamp()))
+  {
+    std::cerr << "Room made for 3 blocks with a pinned and a pending block in a budget of 4" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!CheckCached({a}, {b}) || cache->Find(e->index) != e)
+    return EXIT_FAILURE;
+
+  // Blocks used since the protected stamp are not evicted
+  cache->Unpin(a);
+  const uint64_t stamp = cache->GetStamp();
+  CacheType::BlockPointer f = InsertReady(cache, MakeIndex(5, 0));
+  cache->Find(a->index);
+  if (cache->MakeRoom(2 * blockBytes, stamp) || !CheckCached({a, f}, {}))
+  {
+    std::cerr << "Protected blocks evicted" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (cache->GetBytes() > cache->GetMaxBytes())
+  {
+    std::cerr << "Cache size " << cache->GetBytes() << " exceeds the budget " << cache->GetMaxBytes() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbVectorImage.h"
+#include "otbPrefetchCacheAsyncFilter.h"
+#include "otbSyntheticLatencySource.h"
+
+#include "itkImageRegionConstIterator.h"
+
+#include <iostream>
+#include <cstdlib>
+
+namespace
+{
+
+typedef otb::VectorImage<float, 2>               ImageType;
+typedef ImageType::RegionType                    RegionType;
+typedef ImageType::SizeType                      SizeType;
+typedef otb::SyntheticLatencySource<ImageType>   SourceType;
+typedef otb::PrefetchCacheAsyncFilter<ImageType> FilterType;
+
+/* Predictor that never guesses: only the requested regions are cached */
+class NullRegionPredictor : public otb::PrefetchRegionPredictor<RegionType>
+{
+public:
+  typedef NullRegionPredictor                            Self;
+  typedef otb::PrefetchRegionPredictor<RegionType>       Superclass;
+  typedef itk::SmartPointer<Self>                        Pointer;
+
+  itkNewMacro(Self);
+
+  const char * GetPredictorName() const override
+  {
+    return "null";
+  }
+
+protected:
+  bool PredictNext(const RegionHistory &, RegionType &) const override
+  {
+    return false;
+  }
+};
+
+} // end namespace
+
+
+/**
+ * Walk the tiles of an image, padded like the requests of a neighborhood
+ * filter, and check that the cache stays within its memory budget while the
+ * output matches the input.
+ */
+int otbPrefetchCacheBudgetTest(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  const unsigned int nbOfBands = 3;
+  const itk::SizeValueType imageSize = 512;
+  const itk::SizeValueType tileSize = 128;
+  const itk::SizeValueType padding = 8;
+
+  SourceType::Pointer source = SourceType::New();
+  SizeType size;
+  size.Fill(imageSize);
+  source->SetSize(size);
+  source->SetNumberOfBands(nbOfBands);
+  source->SetLatency(0);
+  source->SetJitter(0);
+  source->UpdateOutputInformation();
+
+  // A padded tile spans 16 blocks of 64x64 pixels, the budget holds 20 blocks
+  const uint64_t blockBytes = 64 * 64 * nbOfBands * sizeof(float);
+  SizeType blockSize;
+  blockSize.Fill(64);
+  FilterType::Pointer filter = FilterType::New();
+  filter->SetInput(source->GetOutput());
+  filter->SetBlockSize(blockSize);
+  filter->SetMemoryBudget(20 * blockBytes);
+  filter->SetPredictor(NullRegionPredictor::New().GetPointer());
+  filter->UpdateOutputInformation();
+
+  const RegionType largestRegion = filter->GetOutput()->GetLargestPossibleRegion();
+  for (itk::SizeValueType y = 0; y < imageSize; y += tileSize)
+    for (itk::SizeValueType x = 0; x < imageSize; x += tileSize)
+    {
+      RegionType region;
+      region.SetIndex(0, x);
+      region.SetIndex(1, y);
+      region.SetSize(0, tileSize);
+      region.SetSize(1, tileSize);
+      region.PadByRadius(padding);
+      region.Crop(largestRegion);
+
+      ImageType * output = filter->GetOutput();
+      output->SetRequestedRegion(region);
+      output->UpdateOutputData();
+
+      FilterType::CacheType * cache = filter->GetCache();
+      if (cache->GetBytes() > cache->GetMaxBytes())
+      {
+        std::cerr << "Cache size " << cache->GetBytes() << " exceeds the budget " << cache->GetMaxBytes()
+                  << " after region " << region << std::endl;
+        return EXIT_FAILURE;
+      }
+
+      itk::ImageRegionConstIterator<ImageType> it(output, region);
+      for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+        for (unsigned int band = 0; band < nbOfBands; ++band)
+          if (it.Get()[band] != SourceType::PixelValue(it.GetIndex(), band))
+          {
+            std::cerr << "Wrong pixel " << it.GetIndex() << " in region " << region << std::endl;
+            return EXIT_FAILURE;
+          }
+    }
+
+  return EXIT_SUCCESS;
+}
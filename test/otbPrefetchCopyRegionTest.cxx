@@ -0,0 +1,149 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbImage.h"
+#include "otbVectorImage.h"
+#include "otbPrefetchCacheAsyncFilter.h"
+
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIterator.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+
+namespace
+{
+
+typedef otb::VectorImage<float, 2>          VectorImageType;
+typedef otb::Image<uint16_t, 2>             ScalarImageType;
+typedef VectorImageType::RegionType         RegionType;
+
+RegionType MakeRegion(itk::IndexValueType x, itk::IndexValueType y, itk::SizeValueType sx, itk::SizeValueType sy)
+{
+  RegionType region;
+  region.SetIndex(0, x);
+  region.SetIndex(1, y);
+  region.SetSize(0, sx);
+  region.SetSize(1, sy);
+  return region;
+}
+
+/* Value of a component of a pixel */
+double Value(const itk::Index<2> & index, unsigned int band)
+{
+  return (index[0] * 7 + index[1] * 13 + band * 101) % 65521;
+}
+
+/* Image buffered on a region, with the values of Value(), or zeros */
+template <class TImage>
+typename TImage::Pointer MakeImage(const RegionType & region, unsigned int nbOfBands, bool fill)
+{
+  typedef typename TImage::InternalPixelType ValueType;
+  typename TImage::Pointer image = TImage::New();
+  image->SetRegions(region);
+  image->SetNumberOfComponentsPerPixel(nbOfBands);
+  image->Allocate();
+  ValueType * buffer = image->GetBufferPointer();
+  itk::ImageRegionConstIteratorWithIndex<TImage> it(image, region);
+  for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+  {
+    const itk::OffsetValueType offset = image->ComputeOffset(it.GetIndex()) * nbOfBands;
+    for (unsigned int band = 0; band < nbOfBands; ++band)
+      buffer[offset + band] = fill ? static_cast<ValueType>(Value(it.GetIndex(), band)) : 0;
+  }
+  return image;
+}
+
+/* Copy a region between two images buffered on different regions, and check
+ * the copied pixels and the pixels around them */
+template <class TImage>
+bool CheckCopy(unsigned int nbOfBands)
+{
+  typedef otb::PrefetchCacheAsyncFilter<TImage> FilterType;
+  typedef typename TImage::InternalPixelType ValueType;
+  const RegionType sourceRegion = MakeRegion(-3, 5, 97, 61);
+  const RegionType destinationRegion = MakeRegion(10, -2, 120, 50);
+  RegionType region = MakeRegion(12, 9, 53, 31);
+  typename TImage::Pointer source = MakeImage<TImage>(sourceRegion, nbOfBands, true);
+  typename TImage::Pointer destination = MakeImage<TImage>(destinationRegion, nbOfBands, false);
+  FilterType::CopyRegion(source, destination, region);
+
+  const ValueType * buffer = destination->GetBufferPointer();
+  itk::ImageRegionConstIteratorWithIndex<TImage> it(destination, destinationRegion);
+  for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+  {
+    const itk::OffsetValueType offset = destination->ComputeOffset(it.GetIndex()) * nbOfBands;
+    for (unsigned int band = 0; band < nbOfBands; ++band)
+    {
+      const ValueType expected = region.IsInside(it.GetIndex()) ? static_cast<ValueType>(Value(it.GetIndex(), band)) : 0;
+      if (buffer[offset + band] != expected)
+      {
+        std::cerr << "Wrong value " << buffer[offset + band] << " instead of " << expected << " at " << it.GetIndex()
+                  << " band " << band << " (" << nbOfBands << " bands)" << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/* Best time of a few runs of a function */
+template <class TFunction>
+double BestSeconds(TFunction function)
+{
+  double best = 0;
+  for (unsigned int run = 0; run < 5; ++run)
+  {
+    auto start{std::chrono::steady_clock::now()};
+    function();
+    const std::chrono::duration<double> seconds{std::chrono::steady_clock::now() - start};
+    best = (run == 0) ? seconds.count() : std::min(best, seconds.count());
+  }
+  return best;
+}
+
+} // end namespace
+
+
+/**
+ * Check the copy of regions between the cache blocks and the outputs, for
+ * vector and scalar images, and that the copy of a 13 bands float image is
+ * done by whole lines: it must be much faster than a copy pixel by pixel.
+ */
+int otbPrefetchCopyRegionTest(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  if (!CheckCopy<VectorImageType>(13) || !CheckCopy<VectorImageType>(1) || !CheckCopy<ScalarImageType>(1))
+    return EXIT_FAILURE;
+
+  typedef otb::PrefetchCacheAsyncFilter<VectorImageType> FilterType;
+  const unsigned int nbOfBands = 13;
+  const RegionType region = MakeRegion(0, 0, 512, 512);
+  VectorImageType::Pointer source = MakeImage<VectorImageType>(MakeRegion(-16, -16, 544, 544), nbOfBands, true);
+  VectorImageType::Pointer destination = MakeImage<VectorImageType>(region, nbOfBands, false);
+
+  const double copySeconds = BestSeconds([&]() { FilterType::CopyRegion(source, destination, region); });
+  const double pixelSeconds = BestSeconds([&]() {
+    itk::ImageRegionConstIterator<VectorImageType> inIt(source, region);
+    itk::ImageRegionIterator<VectorImageType>      outIt(destination, region);
+    for (inIt.GoToBegin(), outIt.GoToBegin(); !inIt.IsAtEnd(); ++inIt, ++outIt)
+      outIt.Set(inIt.Get());
+  });
+  std::cout << "Copy of " << nbOfBands << " bands: " << copySeconds << "s by lines, " << pixelSeconds << "s by pixels" << std::endl;
+  if (2 * copySeconds > pixelSeconds)
+  {
+    std::cerr << "The copy by lines is not faster than the copy by pixels" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,19 @@
+/*=========================================================================
+
+     Copyright (c) 2024 INRAE
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbTestMain.h"
+
+void RegisterTests()
+{
+  REGISTER_TEST(otbPrefetchCacheBudgetTest);
+  REGISTER_TEST(otbPrefetchBlockCacheTest);
+  REGISTER_TEST(otbPrefetchCopyRegionTest);
+}
@@ -1,7 +1,10 @@
 from planetary_computer import sign_inplace
 from pystac_client import Client
 import pyotb
+import otbApplication
 from functools import partial
+import os
+import tempfile
 
 
 api = Client.open(
@@ -26,6 +29,28 @@ apps = [
   partial(pyotb.MeanShiftSmoothing)
 ]
 
+def write_roi(filename="/tmp/roi_uint16.tif"):
+  """
+  Write a 2048x2048 extract of the B04 band, as a local uint16 file.
+  """
+  pyotb.ExtractROI(b4_href, startx=0, starty=0, sizex=2048, sizey=2048).write(filename, pixel_type="uint16")
+  return filename
+
+def get_stats(prefetch, keys=("processed", "fetched", "disk")):
+  """
+  Statistics of a Prefetch application.
+  """
+  return {key: prefetch.app.GetParameterDouble(f"stats.{key}") for key in keys}
+
+def assert_same(ref, meas, nb_bands=1):
+  """
+  Check that two images have the same pixels, in all their bands.
+  """
+  for band in range(1, nb_bands + 1):
+    cmp = pyotb.CompareImages(ref_in=ref, ref_channel=band, meas_in=meas, meas_channel=band)
+    count = cmp.app.GetParameterFloat("count")
+    assert count == 0, f"{count:.0f} pixels differ in band {band} (mae: {cmp.app.GetParameterFloat('mae')})"
+
 def compare():
   """
   Compare that the application returns the same result 
@@ -37,6 +62,17 @@ def compare():
       meas_in=app(pyotb.Prefetch(b4_href))
     )
 
+def predictors():
+  """
+  Compare that the application returns the same result
+  for prefetched and vanilla inputs, with all predictors.
+  """
+  for predictor in ["grid", "stride", "legacy"]:
+    pyotb.CompareImages(
+      ref_in=apps[0](b4_href),
+      meas_in=apps[0](pyotb.Prefetch(b4_href, predictor=predictor))
+    )
+
 def strategies():
   """
   Testing that all applications runs fine for prefetched inputs
@@ -52,5 +88,116 @@ def strategies():
       ext_fname["streaming:type"] = strategy
       app(pyotb.Prefetch(b4_href)).write(out, ext_fname=ext_fname)
  
+def native_types():
+  """
+  Testing that integer inputs, prefetched with their native pixel type,
+  are written back unchanged. The B04 band is uint16, an int16 image is
+  derived from it.
+  """
+  int16_file = "/tmp/int16.tif"
+  roi = pyotb.ExtractROI(b4_href, startx=0, starty=0, sizex=2048, sizey=2048)
+  pyotb.BandMath(il=[roi], exp="im1b1 - 5000").write(int16_file, pixel_type="int16")
+  for href, pixel_type in [(b4_href, "uint16"), (int16_file, "int16")]:
+    out = f"/tmp/prefetch_{pixel_type}.tif"
+    pyotb.Prefetch(href).write(out, pixel_type=pixel_type)
+    assert_same(href, out)
+
+def image_list():
+  """
+  Compare the concatenation of prefetched images with the one of
+  ConcatenateImages, for files and in-memory images of various pixel types
+  (scalar uint16 images, scalar float images, float vector images).
+  """
+  roi_file = write_roi()
+  image_lists = [
+    ([roi_file, pyotb.Prefetch(roi_file)], 2),
+    ([pyotb.Prefetch(roi_file), pyotb.BandMath(il=[roi_file], exp="im1b1 / 2")], 2),
+    ([roi_file, pyotb.ConcatenateImages(il=[roi_file, roi_file])], 3),
+  ]
+  for il, nb_bands in image_lists:
+    assert_same(pyotb.ConcatenateImages(il=il), pyotb.Prefetch(il=il), nb_bands)
+
+def disk_cache():
+  """
+  Testing that a second run with the same disk cache reads the blocks from
+  the disk instead of the input, and gives the same output. With a disk
+  cache smaller than the input, the least recently used blocks are deleted
+  and fetched again.
+  """
+  roi_file = write_roi()
+  cachedir = tempfile.mkdtemp()
+  stats = []
+  for run in range(2):
+    out = f"/tmp/prefetch_disk_{run}.tif"
+    prefetch = pyotb.Prefetch(roi_file, cachedir=cachedir)
+    prefetch.write(out, pixel_type="uint16")
+    stats.append(get_stats(prefetch))
+    assert_same(roi_file, out)
+  assert_same("/tmp/prefetch_disk_0.tif", "/tmp/prefetch_disk_1.tif")
+  assert stats[0]["disk"] == 0, stats[0]
+  assert stats[1]["disk"] > 0 and stats[1]["fetched"] == 0, stats[1]
+
+  cachedir = tempfile.mkdtemp()
+  cachesize = 1  # MB, the input is 8 MB
+  for run in range(2):
+    out = f"/tmp/prefetch_evicted_{run}.tif"
+    prefetch = pyotb.Prefetch(roi_file, cachedir=cachedir, cachesize=cachesize)
+    prefetch.write(out, pixel_type="uint16")
+    assert_same(roi_file, out)
+  stats = get_stats(prefetch)
+  assert stats["fetched"] > 0, stats
+  size = sum(os.path.getsize(os.path.join(root, name)) for root, _, names in os.walk(cachedir) for name in names)
+  assert size <= cachesize * 1024 * 1024, f"Disk cache size {size} exceeds {cachesize} MB"
+
+def disk_cache_key():
+  """
+  Testing that the disk cache key does not depend on the query of the URL
+  (e.g. a new signature) nor on the extended filename options that do not
+  select the pixels: the second run reads blocks from the disk. Only the
+  beginning of the remote image is read, the blocks prefetched beyond it
+  may still be fetched again.
+  """
+  query_pos = b4_href.index("?")
+  params = b4_href[query_pos + 1:].split("&")
+  resigned_href = b4_href[:query_pos + 1] + "&".join(reversed(params))
+  roi_file = write_roi()
+  for first, second in [(b4_href, resigned_href), (roi_file, f"{roi_file}?&skipcarto=false")]:
+    assert first != second
+    cachedir = tempfile.mkdtemp()
+    stats = []
+    for href in (first, second):
+      prefetch = pyotb.Prefetch(href, cachedir=cachedir)
+      extract = pyotb.ExtractROI(prefetch, startx=0, starty=0, sizex=1024, sizey=1024)
+      extract.write("/tmp/prefetch_key.tif", pixel_type="uint16")
+      stats.append(get_stats(prefetch))
+    assert stats[0]["disk"] == 0, stats[0]
+    assert stats[1]["disk"] > 0, f"The blocks of {first} were not found with {second}: {stats[1]}"
+
+def streaming_plan():
+  """
+  Testing that the streaming plan of the writer is prefetched: the output
+  is written with a tiled streaming, and the requested regions are found
+  in the plan. The output must be identical to the input.
+  The application is used directly (not through pyotb), so that `out` is
+  set before the execution, when the plan is computed.
+  """
+  roi_file = write_roi()
+  out = "/tmp/prefetch_plan.tif"
+  ext_fname = "streaming:type=tiled&streaming:sizemode=height&streaming:sizevalue=256"
+  app = otbApplication.Registry.CreateApplication("Prefetch")
+  app.SetParameterString("in", roi_file)
+  app.SetParameterString("out", f"{out}?&{ext_fname}")
+  app.SetParameterOutputImagePixelType("out", otbApplication.ImagePixelType_uint16)
+  app.ExecuteAndWriteOutput()
+  assert_same(roi_file, out)
+  planhit = app.GetParameterDouble("stats.planhit")
+  assert planhit > 0, f"No requested region was found in the streaming plan ({planhit})"
+
 compare()
+predictors()
 strategies()
+native_types()
+image_list()
+disk_cache()
+disk_cache_key()
+streaming_plan()